@@ -0,0 +1,456 @@
+#include "OneWireSim.h"
+#include "mbed.h"
+#include <string.h>
+
+#define RESET_MIN_US        480     // low for at least this long is a reset
+#define WRITE1_MAX_US       15      // devices sample the written bit after this
+#define DEVICE_HOLD_US      30      // a device sending 0 holds the line this long
+#define PRESENCE_START_US   15
+#define PRESENCE_END_US     135
+#define SLOT_SPAN_US        70      // tSLOT plus recovery, for the activity counter
+#define RESET_SPAN_US       1000    // reset plus presence detect
+
+struct OneWireSim::device {
+    enum mode {
+        idle,           // not addressed, waits for the next reset
+        rom_command,
+        search,
+        match,
+        function_command,
+        rx_bytes,       // Write Scratchpad data
+        tx_bytes,       // Read Scratchpad data
+        tx_status,      // 0 while busy, 1 when done
+        tx_power        // one bit, 1 if externally powered
+    };
+
+    uint8_t ROM[8];
+    uint8_t scratchpad[9];
+    uint8_t eeprom[3];
+    int16_t raw;
+    bool attached, parasite;
+    uint64_t busy_until;
+    bool conversion_pending;
+
+    mode state;
+    int bit;
+    int phase;          // search: 0 send bit, 1 send complement, 2 receive
+    uint8_t shift;
+    uint8_t rx[3];
+
+    int tx_bit(uint64_t now) {
+    // -1 if this device does not drive the slot, otherwise the bit it sends
+        switch (state) {
+            case search: {
+                int value = (ROM[bit >> 3] >> (bit & 7)) & 1;
+                if (phase == 0) return value;
+                if (phase == 1) return !value;
+                return -1;
+            }
+            case tx_bytes:  return bit < 72 ? (scratchpad[bit >> 3] >> (bit & 7)) & 1 : 1;
+            case tx_status: return now >= busy_until;
+            case tx_power:  return !parasite;
+            default:        return -1;
+        }
+    }
+
+    void update_scratchpad(uint64_t now) {
+        if (conversion_pending && now >= busy_until) {
+            int shift_out = 3 - ((scratchpad[4] >> 5) & 3);    // lower resolutions leave bits undefined (0)
+            int16_t value = raw & ~((1 << shift_out) - 1);
+            scratchpad[0] = value & 0xFF;
+            scratchpad[1] = (value >> 8) & 0xFF;
+            scratchpad[8] = OneWireSim::crc8(scratchpad, 8);
+            conversion_pending = false;
+        }
+    }
+
+    void reset() {
+        state = attached ? rom_command : idle;
+        bit = 0;
+        phase = 0;
+        shift = 0;
+    }
+
+    bool shift_in(bool value) {
+        shift = (shift >> 1) | (value ? 0x80 : 0);
+        return ++bit == 8;
+    }
+
+    int slot(bool value, uint64_t now, counters &stats) {
+    // Returns the function command this slot completed, -1 if none
+        int command = -1;
+        update_scratchpad(now);
+        switch (state) {
+            case rom_command:
+                if (!shift_in(value))
+                    break;
+                bit = 0;
+                phase = 0;
+                switch (shift) {
+                    case 0xF0: state = search; break;
+                    case 0x55: state = match; break;
+                    case 0xCC: state = function_command; shift = 0; break;
+                    default:   state = idle; break;
+                }
+                break;
+            case search:
+                if (phase < 2) {
+                    phase++;
+                } else if (value != ((ROM[bit >> 3] >> (bit & 7)) & 1)) {
+                    state = idle;           // dropped out of the search
+                } else {
+                    phase = 0;
+                    if (++bit == 64) {
+                        state = function_command;
+                        bit = 0;
+                    }
+                }
+                break;
+            case match:
+                if (value != ((ROM[bit >> 3] >> (bit & 7)) & 1))
+                    state = idle;
+                else if (++bit == 64) {
+                    state = function_command;
+                    bit = 0;
+                }
+                break;
+            case function_command:
+                if (!shift_in(value))
+                    break;
+                stats.commands[shift]++;
+                command = shift;
+                bit = 0;
+                switch (shift) {
+                    case 0x44:
+                        busy_until = now + conversion_time();
+                        conversion_pending = true;
+                        state = tx_status;
+                        break;
+                    case 0xBE: state = tx_bytes; break;
+                    case 0x4E: state = rx_bytes; break;
+                    case 0x48:
+                        memcpy(eeprom, scratchpad + 2, 3);
+                        stats.eeprom_writes++;
+                        busy_until = now + 10000;
+                        state = tx_status;
+                        break;
+                    case 0xB8:
+                        memcpy(scratchpad + 2, eeprom, 3);
+                        scratchpad[8] = OneWireSim::crc8(scratchpad, 8);
+                        busy_until = now;
+                        state = tx_status;
+                        break;
+                    case 0xB4: state = tx_power; break;
+                    default:   state = idle; break;
+                }
+                break;
+            case rx_bytes:
+                if (value)
+                    rx[bit >> 3] |= 1 << (bit & 7);
+                else
+                    rx[bit >> 3] &= ~(1 << (bit & 7));
+                if (++bit == 24) {
+                    scratchpad[2] = rx[0];
+                    scratchpad[3] = rx[1];
+                    scratchpad[4] = rx[2] | 0x1F;   // unused config bits read as 1
+                    scratchpad[8] = OneWireSim::crc8(scratchpad, 8);
+                    state = idle;
+                }
+                break;
+            case tx_bytes:
+                bit++;
+                break;
+            case tx_power:
+                state = idle;
+                break;
+            default:
+                break;
+        }
+        return command;
+    }
+
+    uint32_t conversion_time() {
+        static const uint32_t times[4] = {93750, 187500, 375000, 750000};
+        return times[(scratchpad[4] >> 5) & 3];
+    }
+};
+
+OneWireSim &OneWireSim::bus() {
+    static OneWireSim instance;
+    return instance;
+}
+
+OneWireSim::OneWireSim() {
+    clear();
+}
+
+void OneWireSim::clear() {
+    _devices.clear();
+    _now = 0;
+    _output = false;
+    _value = false;
+    _low = false;
+    _fall = _rise = 0;
+    _slot_open = _slot_reset = _slot_pull = false;
+    _timeout = NULL;
+    _timeout_at = 0;
+    _noise = 0;
+    _seed = 1;
+    _stretch = 0;
+    _stretch_us = 0;
+    _stretch_pending = false;
+    resetCounters();
+}
+
+int OneWireSim::addDevice(uint8_t ROM[8], float celsius) {
+    device d;
+    memset(&d, 0, sizeof(d));
+    ROM[7] = crc8(ROM, 7);
+    memcpy(d.ROM, ROM, 8);
+    static const uint8_t power_up[9] = {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0x00};
+    memcpy(d.scratchpad, power_up, 9);
+    d.scratchpad[8] = crc8(d.scratchpad, 8);
+    memcpy(d.eeprom, power_up + 2, 3);
+    d.attached = true;
+    d.state = device::idle;
+    _devices.push_back(d);
+    setTemperature(_devices.size() - 1, celsius);
+    return _devices.size() - 1;
+}
+
+void OneWireSim::setTemperature(int index, float celsius) {
+    _devices[index].raw = (int16_t)floor(celsius * 16.0f + 0.5f);
+}
+
+void OneWireSim::setScratchpad(int index, const uint8_t *data) {
+    device &d = _devices[index];
+    memcpy(d.scratchpad, data, 8);
+    d.scratchpad[8] = crc8(d.scratchpad, 8);
+    memcpy(d.eeprom, data + 2, 3);
+    d.raw = (int16_t)(data[0] | (data[1] << 8));
+}
+
+void OneWireSim::setAttached(int index, bool attached) {
+    _devices[index].attached = attached;
+    if (!attached)
+        _devices[index].state = device::idle;
+}
+
+void OneWireSim::setParasite(int index, bool parasite) {
+    _devices[index].parasite = parasite;
+}
+
+int OneWireSim::devices() {
+    return _devices.size();
+}
+
+void OneWireSim::setNoise(double bit_error_rate, uint32_t seed) {
+    _noise = bit_error_rate;
+    _seed = seed ? seed : 1;
+}
+
+void OneWireSim::setStretch(double probability, uint32_t stretch_us, bool pending) {
+    _stretch = probability;
+    _stretch_us = stretch_us;
+    _stretch_pending = pending;
+}
+
+void OneWireSim::resetCounters() {
+    memset(&_stats, 0, sizeof(_stats));
+    if (_slot_open)
+        _fall = _now;           // count the open slot from here on
+}
+
+const OneWireSim::counters &OneWireSim::stats() {
+    return _stats;
+}
+
+uint64_t OneWireSim::now() {
+    return _now;
+}
+
+uint64_t OneWireSim::activeTime() {
+    uint64_t span = _slot_open ? _now - _fall : 0;
+    uint64_t cap = _slot_reset ? RESET_SPAN_US : SLOT_SPAN_US;
+    return _stats.active_us + (span < cap ? span : cap);
+}
+
+uint8_t OneWireSim::crc8(const uint8_t *data, int length) {
+    uint8_t crc = 0;
+    for (int i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+        for (int j = 0; j < 8; j++) {
+            uint8_t mix = (crc ^ byte) & 0x01;
+            crc >>= 1;
+            if (mix)
+                crc ^= 0x8C;
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+void OneWireSim::pinOutput(bool output) {
+    _output = output;
+    line_changed();
+}
+
+void OneWireSim::pinWrite(int value) {
+    _value = value != 0;
+    line_changed();
+}
+
+int OneWireSim::pinRead() {
+    bool level = true;
+    if (_low) {
+        level = false;
+    } else if (_slot_open && !_slot_reset) {
+        level = !(_slot_pull && _now - _fall < DEVICE_HOLD_US);
+    } else if (_slot_reset && _now - _rise >= PRESENCE_START_US && _now - _rise < PRESENCE_END_US) {
+        for (size_t i = 0; i < _devices.size(); i++)
+            if (_devices[i].attached)
+                level = false;
+    }
+    if (_noise > 0 && random() < _noise * 4294967296.0) {
+        _stats.bit_errors++;
+        level = !level;
+    }
+    return level;
+}
+
+void OneWireSim::advance(uint32_t us) {
+    _now += us;
+    if (_stretch > 0 && !_stretch_pending && __get_PRIMASK() == 0 && random() < _stretch * 4294967296.0) {
+        _stats.stretches++;
+        _now += _stretch_us;
+    }
+}
+
+void OneWireSim::irqEnabled() {
+    if (_stretch > 0 && _stretch_pending && random() < _stretch * 4294967296.0) {
+        _stats.stretches++;
+        _now += _stretch_us;
+    }
+}
+
+void OneWireSim::sleep() {
+    if (_timeout == NULL) {
+        fprintf(stderr, "sleep() without a pending Timeout would never wake up\n");
+        exit(1);
+    }
+    if (_timeout_at > _now) {
+        _stats.sleep_us += _timeout_at - _now;
+        _now = _timeout_at;
+    }
+    void (*handler)(void) = _timeout;
+    _timeout = NULL;
+    handler();
+}
+
+void OneWireSim::attachTimeout(void (*handler)(void), uint32_t us) {
+    _timeout = handler;
+    _timeout_at = _now + us;
+}
+
+void OneWireSim::detachTimeout(void (*handler)(void)) {
+    if (_timeout == handler)
+        _timeout = NULL;
+}
+
+void OneWireSim::line_changed() {
+    bool low = _output && !_value;
+    if (low == _low)
+        return;
+    _low = low;
+    if (low) {
+        slot_start();
+    } else {
+        _rise = _now;
+        slot_end(_now - _fall);
+    }
+}
+
+void OneWireSim::slot_start() {
+    close_slot();
+    _fall = _now;
+    _slot_open = true;
+    _slot_reset = false;
+    _slot_pull = false;
+    for (size_t i = 0; i < _devices.size(); i++) {
+        if (_devices[i].tx_bit(_now) == 0)
+            _slot_pull = true;
+    }
+}
+
+void OneWireSim::slot_end(uint32_t low_us) {
+    if (low_us >= RESET_MIN_US) {
+        _stats.resets++;
+        _slot_reset = true;
+        for (size_t i = 0; i < _devices.size(); i++)
+            _devices[i].reset();
+        return;
+    }
+    _stats.slots++;
+    bool value = low_us < WRITE1_MAX_US;
+    int command = -1;
+    for (size_t i = 0; i < _devices.size(); i++) {
+        int received = _devices[i].slot(value, _now, _stats);
+        if (received >= 0)
+            command = received;
+    }
+    if (command >= 0)
+        _stats.transactions[command]++;
+}
+
+void OneWireSim::close_slot() {
+    if (_slot_open) {
+        uint64_t span = _now - _fall;
+        uint64_t cap = _slot_reset ? RESET_SPAN_US : SLOT_SPAN_US;
+        _stats.active_us += span < cap ? span : cap;
+        _slot_open = false;
+    }
+}
+
+uint32_t OneWireSim::random() {
+    // xorshift32, enough for noise injection and reproducible across hosts
+    _seed ^= _seed << 13;
+    _seed ^= _seed >> 17;
+    _seed ^= _seed << 5;
+    return _seed;
+}
+
+void host_pin_output(PinName, bool output) {
+    OneWireSim::bus().pinOutput(output);
+}
+
+void host_pin_write(PinName, int value) {
+    OneWireSim::bus().pinWrite(value);
+}
+
+int host_pin_read(PinName) {
+    return OneWireSim::bus().pinRead();
+}
+
+uint32_t host_time_us() {
+    return (uint32_t)OneWireSim::bus().now();
+}
+
+void host_wait_us(uint32_t us) {
+    OneWireSim::bus().advance(us);
+}
+
+void host_irq_enabled() {
+    OneWireSim::bus().irqEnabled();
+}
+
+void host_sleep() {
+    OneWireSim::bus().sleep();
+}
+
+void host_timeout_attach(void (*handler)(void), uint32_t us) {
+    OneWireSim::bus().attachTimeout(handler, us);
+}
+
+void host_timeout_detach(void (*handler)(void)) {
+    OneWireSim::bus().detachTimeout(handler);
+}
@@ -0,0 +1,105 @@
+/* Simulated 1-Wire bus with DS18B20 devices for running the DS1820 library on a host
+ *
+ * The master side is whatever drives the pins through host/mbed.h. Every falling
+ * edge starts a slot, the release classifies it (reset, write 0, write 1/read) and
+ * each attached device answers the way the datasheet describes: presence pulse,
+ * ROM commands including Search ROM, Convert T, Read/Write/Copy Scratchpad,
+ * Recall E2 and Read Power Supply. Time is virtual, see host_wait_us.
+ */
+
+#ifndef ONEWIRE_SIM_H
+#define ONEWIRE_SIM_H
+
+#include <stdint.h>
+#include <vector>
+
+class OneWireSim {
+public:
+    struct counters {
+        uint32_t resets;
+        uint32_t slots;             // read and write time slots, resets excluded
+        uint32_t commands[256];     // function commands by opcode, counted per addressed device
+        uint32_t transactions[256]; // function commands by opcode, counted once as sent by the master
+        uint32_t eeprom_writes;     // Copy Scratchpad executions
+        uint32_t bit_errors;        // sampled bits flipped by injected noise
+        uint32_t stretches;         // waits lengthened by an injected interrupt
+        uint64_t active_us;         // time covered by resets and slots
+        uint64_t sleep_us;          // time the master spent in sleep()
+    };
+
+    static OneWireSim &bus();
+
+    /** Removes all devices and resets counters, clock and noise */
+    void clear();
+
+    /** Adds a DS18B20 (or other family) device
+     *
+     * @param ROM 8 byte ROM code, the CRC byte is filled in
+     * @param celsius temperature the device will measure
+     * @return index of the device
+     */
+    int addDevice(uint8_t ROM[8], float celsius);
+
+    void setTemperature(int device, float celsius);
+
+    /** Loads scratchpad bytes 0-7 (CRC is filled in), later conversions reproduce the temperature */
+    void setScratchpad(int device, const uint8_t *data);
+    void setAttached(int device, bool attached);
+    void setParasite(int device, bool parasite);
+    int devices();
+
+    /** Flips sampled bits with the given probability (deterministic for a seed) */
+    void setNoise(double bit_error_rate, uint32_t seed);
+
+    /** Lengthens waits done with interrupts enabled by stretch_us, as an interrupt
+     *  handler would, with the given probability per wait. A stretch that lands in
+     *  a low phase turns a write 0 into a reset, which the library has to detect.
+     *  With pending set the stretch happens instead at the moment interrupts are
+     *  re-enabled, as an interrupt that became pending while they were masked.
+     */
+    void setStretch(double probability, uint32_t stretch_us, bool pending = false);
+
+    void resetCounters();
+    const counters &stats();
+    uint64_t now();
+    uint64_t activeTime();              // includes the slot that is still open
+
+    static uint8_t crc8(const uint8_t *data, int length);
+
+    // host/mbed.h hooks
+    void pinOutput(bool output);
+    void pinWrite(int value);
+    int pinRead();
+    void advance(uint32_t us);
+    void irqEnabled();
+    void sleep();
+    void attachTimeout(void (*handler)(void), uint32_t us);
+    void detachTimeout(void (*handler)(void));
+
+private:
+    struct device;
+
+    OneWireSim();
+    void line_changed();
+    void slot_start();
+    void slot_end(uint32_t low_us);
+    void close_slot();
+    uint32_t random();
+
+    std::vector<device> _devices;
+    counters _stats;
+    uint64_t _now;
+    bool _output, _value, _low;
+    uint64_t _fall, _rise;              // last master falling edge and release
+    bool _slot_open, _slot_reset;
+    bool _slot_pull;                    // a device holds the line low in this slot
+    void (*_timeout)(void);             // pending Timeout handler, NULL if none
+    uint64_t _timeout_at;
+    double _noise;
+    double _stretch;
+    uint32_t _stretch_us;
+    bool _stretch_pending;
+    uint32_t _seed;
+};
+
+#endif
@@ -0,0 +1,450 @@
+/* Deterministic benchmarks for the DS1820 library on a simulated bus
+ *
+ * Runs full sweeps (broadcast Convert T, then a scratchpad read per probe) for
+ * 1, 8, 32 and 100 probes with and without injected bit noise, and with
+ * interrupts stretching the unmasked slot phases or running as soon as a masked
+ * phase ends (the overrun/retry path). Bus figures come
+ * from the virtual clock and are identical on every host, the CPU figures time
+ * the decode and CRC paths on the host itself. The periodic sampler is checked
+ * for start-time jitter and missed deadlines at 1 Hz and 4 Hz, the reading cache
+ * for bus traffic with several consumers per loop and the staggered pipeline for
+ * throughput, evenness of the output stream and sample age. A mixed bus compares
+ * the family-targeted enumeration with a walk of the whole search tree, a noisy
+ * bus with a spare probe checks that maintainBus does not swap ROMs, storing a
+ * resolution in EEPROM is timed per probe and batched, and a
+ * once-a-minute sampler reports time awake and busy with and without sleep.
+ * The memory records give the RAM taken by the probe objects and their bus;
+ * these are host sizes, "make sizes" prints the target's.
+ *
+ * Output is one JSON object per line on stdout.
+ */
+
+#include "mbed.h"
+#include "DS1820.h"
+#include "DS1820Pipeline.h"
+#include "DS1820Sampler.h"
+#include "DS1820Trace.h"
+#include "OneWireSim.h"
+#include <string.h>
+#include <time.h>
+
+#define DATA_PIN    ((PinName)3)
+#define SWEEPS      5
+#define SAMPLES     20
+#define PIPELINE_US 10000000    // virtual run time of each pipeline configuration
+
+static const int probe_counts[] = {1, 8, 32, 100};
+#define STRETCH_US  600         // a long interrupt handler, e.g. the radio or display refresh
+
+static const struct {
+    double noise;               // bit error rate
+    double stretch;             // probability that an unmasked wait is stretched by STRETCH_US
+    bool pending;               // ... or rather the moment interrupts are re-enabled
+} conditions[] = {{0.0, 0.0, false}, {0.0005, 0.0, false}, {0.005, 0.0, false}, {0.0, 0.002, false},
+                  {0.0, 0.02, true}};
+
+static uint32_t rom_seed = 0x1820;
+
+static uint32_t next_random() {
+    rom_seed ^= rom_seed << 13;
+    rom_seed ^= rom_seed >> 17;
+    rom_seed ^= rom_seed << 5;
+    return rom_seed;
+}
+
+static float expected_temperature(int probe) {
+    return 20.0f + probe * 0.25f;
+}
+
+static void add_devices(int count, uint8_t family, int first) {
+// Devices with random serial numbers, device n measures expected_temperature(n)
+    for (int i = first; i < first + count; i++) {
+        uint8_t ROM[8] = {family, 0, 0, 0, 0, 0, 0, 0};
+        for (int b = 1; b < 7; b++)
+            ROM[b] = next_random() & 0xFF;
+        OneWireSim::bus().addDevice(ROM, expected_temperature(i));
+    }
+}
+
+static bool plausible(float value, int count) {
+// Probes enumerate in ROM order, not in the order the devices were added
+    for (int i = 0; i < count; i++)
+        if (value == expected_temperature(i))
+            return true;
+    return false;
+}
+
+static struct {
+    int readings;
+    uint32_t last_us, max_gap_us, max_age_us;
+} pipeline_stats;
+
+static void pipeline_reading(DS1820 *, float, uint32_t timestamp_us) {
+    uint32_t now = (uint32_t)OneWireSim::bus().now();
+    if (pipeline_stats.readings > 0 && now - pipeline_stats.last_us > pipeline_stats.max_gap_us)
+        pipeline_stats.max_gap_us = now - pipeline_stats.last_us;
+    if (now - timestamp_us > pipeline_stats.max_age_us)
+        pipeline_stats.max_age_us = now - timestamp_us;
+    pipeline_stats.last_us = now;
+    pipeline_stats.readings++;
+}
+
+static void bench_pipeline(DS1820 **probes, int count) {
+    OneWireSim &sim = OneWireSim::bus();
+    static const int group_counts[] = {1, 4, 16};
+    for (size_t g = 0; g < sizeof(group_counts) / sizeof(group_counts[0]); g++) {
+        if (group_counts[g] > count)
+            break;
+        DS1820Pipeline pipeline(probes, count, group_counts[g], pipeline_reading);
+        memset(&pipeline_stats, 0, sizeof(pipeline_stats));
+        sim.resetCounters();
+        uint64_t start = sim.now();
+        while (sim.now() - start < PIPELINE_US)
+            wait_ms(pipeline.poll());
+        uint64_t elapsed = sim.now() - start;
+        printf("{\"bench\":\"pipeline\",\"probes\":%d,\"groups\":%d,\"readings_per_s\":%.2f,"
+               "\"max_gap_ms\":%.3f,\"max_sample_age_ms\":%.3f,\"bus_idle_ratio\":%.4f}\n",
+               count, group_counts[g], pipeline_stats.readings * 1e6 / elapsed,
+               pipeline_stats.max_gap_us / 1000.0, pipeline_stats.max_age_us / 1000.0,
+               1.0 - (double)sim.activeTime() / elapsed);
+    }
+}
+
+static uint64_t cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_sweeps(int count) {
+    OneWireSim &sim = OneWireSim::bus();
+    DS1820 *probes[100];
+    sim.clear();
+    add_devices(count, FAMILY_CODE_DS18B20, 0);
+
+    uint64_t start = sim.now();
+    for (int i = 0; i < count; i++)
+        probes[i] = new DS1820(DATA_PIN);
+    printf("{\"bench\":\"enumerate\",\"probes\":%d,\"latency_ms\":%.3f,\"resets\":%u,\"slots\":%u}\n",
+           count, (sim.now() - start) / 1000.0, sim.stats().resets, sim.stats().slots);
+    DS1820::memory_use memory = DS1820::memoryUse();
+    printf("{\"bench\":\"memory\",\"probes\":%d,\"buses\":%d,\"pointer_bytes\":%u,\"probe_bytes\":%d,"
+           "\"bus_bytes\":%d,\"total_bytes\":%d}\n",
+           memory.probes, memory.buses, (unsigned)sizeof(void *), memory.probe_bytes, memory.bus_bytes,
+           memory.probes * memory.probe_bytes + memory.buses * memory.bus_bytes);
+
+    for (size_t n = 0; n < sizeof(conditions) / sizeof(conditions[0]); n++) {
+        int readings = 0, failed = 0, wrong = 0;
+        sim.setNoise(conditions[n].noise, 42);
+        sim.setStretch(conditions[n].stretch, STRETCH_US, conditions[n].pending);
+        sim.resetCounters();
+        start = sim.now();
+        for (int sweep = 0; sweep < SWEEPS; sweep++) {
+            for (int d = 0; d < count; d++)
+                sim.setTemperature(d, expected_temperature(d) + sweep);     // a lost Convert T reads stale
+            probes[0]->convertTemperature(true, DS1820::all_devices);
+            for (int i = 0; i < count; i++) {
+                float value = probes[i]->temperature();
+                readings++;
+                if (value == DS1820::invalid_conversion)
+                    failed++;
+                else if (!plausible(value - sweep, count))
+                    wrong++;
+            }
+        }
+        uint64_t elapsed = sim.now() - start;
+        const OneWireSim::counters &stats = sim.stats();
+        printf("{\"bench\":\"sweep\",\"probes\":%d,\"noise\":%g,\"stretch\":%g,\"pending\":%d,\"sweeps\":%d,"
+               "\"sweep_latency_ms\":%.3f,\"slots_per_reading\":%.1f,\"resets_per_reading\":%.2f,"
+               "\"bus_idle_ratio\":%.4f,\"crc_fail_rate\":%.4f,\"retry_rate\":%.4f,"
+               "\"wrong_reading_rate\":%.4f,\"bit_errors\":%u,\"stretches\":%u}\n",
+               count, conditions[n].noise, conditions[n].stretch, conditions[n].pending ? 1 : 0, SWEEPS,
+               elapsed / 1000.0 / SWEEPS, (double)stats.slots / readings, (double)stats.resets / readings,
+               1.0 - (double)sim.activeTime() / elapsed, (double)failed / readings,
+               (double)(stats.resets - SWEEPS - readings) / readings,  // one reset per transaction without retries
+               (double)wrong / readings, stats.bit_errors, stats.stretches);
+    }
+    sim.setNoise(0, 0);
+    sim.setStretch(0, 0);
+
+    static const uint32_t periods_ms[] = {1000, 250};
+    static const unsigned int resolutions[] = {12, 10};     // 4 Hz needs the 188 ms conversion
+    for (size_t p = 0; p < sizeof(periods_ms) / sizeof(periods_ms[0]); p++) {
+        DS1820::configureAll(resolutions[p]);
+        DS1820Sampler sampler(probes, count, periods_ms[p]);
+        static DS1820Sampler::reading readings[100];
+        uint32_t first = 0, max_jitter = 0;
+        for (int n = 0; n < SAMPLES; n++) {
+            sampler.sample(readings);
+            if (n == 0)
+                first = readings[0].timestamp_us;
+            int32_t jitter = readings[0].timestamp_us - (first + readings[0].sequence * periods_ms[p] * 1000);
+            if ((uint32_t)abs(jitter) > max_jitter)
+                max_jitter = abs(jitter);
+        }
+        printf("{\"bench\":\"sampler\",\"probes\":%d,\"period_ms\":%u,\"resolution\":%u,\"samples\":%d,"
+               "\"max_start_jitter_us\":%u,\"missed_deadlines\":%u}\n",
+               count, periods_ms[p], resolutions[p], SAMPLES, max_jitter, sampler.missedDeadlines());
+    }
+
+    DS1820::configureAll(12);
+    bench_pipeline(probes, count);
+
+    for (int i = 0; i < count; i++)
+        delete probes[i];
+}
+
+static void bench_mixed_bus() {
+// Thermometers sharing the bus with DS2413 switches and DS2431 EEPROMs
+    OneWireSim &sim = OneWireSim::bus();
+    static const uint8_t foreign_families[] = {0x3A, 0x2D};
+    const int count = 8, foreign = 8;
+    DS1820 *probes[count];
+    char foreign_ROMs[foreign][8];
+    sim.clear();
+    add_devices(count, FAMILY_CODE_DS18B20, 0);
+    for (int f = 0; f < 2; f++)
+        add_devices(foreign / 2, foreign_families[f], count + f * foreign / 2);
+
+    sim.resetCounters();
+    for (int i = 0; i < count; i++)
+        probes[i] = new DS1820(DATA_PIN);
+    uint32_t enumerate_slots = sim.stats().slots;
+
+    sim.resetCounters();
+    bool unassigned = DS1820::unassignedProbe(DATA_PIN);    // the check an application does before adding a probe
+    uint32_t check_slots = sim.stats().slots;
+
+    sim.resetCounters();
+    int foreign_found = DS1820::foreignDevices(DATA_PIN, foreign_ROMs, foreign);
+    uint32_t walk_slots = sim.stats().slots;
+
+    // Overruns during the walk are retried, no device may be missed or found twice
+    int walks = 20, wrong_walks = 0;
+    sim.setStretch(0.002, STRETCH_US);
+    for (int walk = 0; walk < walks; walk++)
+        if (DS1820::foreignDevices(DATA_PIN, foreign_ROMs, foreign) != foreign)
+            wrong_walks++;
+    sim.setStretch(0, 0);
+    printf("{\"bench\":\"mixed_bus\",\"probes\":%d,\"foreign\":%d,\"foreign_found\":%d,"
+           "\"unassigned_left\":%d,\"enumerate_slots\":%u,\"unassigned_check_slots\":%u,"
+           "\"full_walk_slots\":%u,\"stretched_walks\":%d,\"wrong_stretched_walks\":%d}\n",
+           count, foreign, foreign_found, unassigned ? 1 : 0, enumerate_slots, check_slots,
+           walk_slots, walks, wrong_walks);
+
+    for (int i = 0; i < count; i++)
+        delete probes[i];
+}
+
+static void bench_store() {
+// Committing a new resolution to EEPROM, probe by probe and batched by configureAll
+    OneWireSim &sim = OneWireSim::bus();
+    const int count = 8;
+    DS1820 *probes[count];
+    sim.clear();
+    add_devices(count, FAMILY_CODE_DS18B20, 0);
+    for (int i = 0; i < count; i++)
+        probes[i] = new DS1820(DATA_PIN);
+    for (int batched = 0; batched < 2; batched++) {
+        unsigned int resolution = batched ? 10 : 11;
+        int stored = 0;
+        sim.resetCounters();
+        uint64_t start = sim.now();
+        if (batched) {
+            stored = DS1820::configureAll(resolution, true);
+        } else {
+            for (int i = 0; i < count; i++)
+                if (probes[i]->setResolution(resolution) && probes[i]->storeConfiguration())
+                    stored++;
+        }
+        printf("{\"bench\":\"store\",\"probes\":%d,\"batched\":%d,\"stored\":%d,\"latency_ms\":%.3f,"
+               "\"resets\":%u,\"copy_transactions\":%u,\"eeprom_writes\":%u}\n",
+               count, batched, stored, (sim.now() - start) / 1000.0, sim.stats().resets, sim.stats().transactions[0x48],
+               sim.stats().eeprom_writes);
+    }
+    for (int i = 0; i < count; i++)
+        delete probes[i];
+}
+
+static void bench_hotplug() {
+// Maintenance on a noisy bus with a spare probe attached, then the swap of a probe
+    OneWireSim &sim = OneWireSim::bus();
+    const int count = 8, calls = 200;
+    DS1820 *probes[count];
+    float before[count];
+    sim.clear();
+    add_devices(count, FAMILY_CODE_DS18B20, 0);
+    for (int i = 0; i < count; i++)
+        probes[i] = new DS1820(DATA_PIN);
+    probes[0]->convertTemperature(true, DS1820::all_devices);
+    for (int i = 0; i < count; i++)
+        before[i] = probes[i]->temperature();
+    add_devices(1, FAMILY_CODE_DS18B20, count);     // plugged in, but no object for it yet
+
+    int changes = 0, wrong = 0;
+    sim.setNoise(0.005, 11);
+    for (int call = 0; call < calls; call++)
+        changes += DS1820::maintainBus(DATA_PIN);
+    sim.setNoise(0, 0);
+    probes[0]->convertTemperature(true, DS1820::all_devices);
+    for (int i = 0; i < count; i++)
+        if (probes[i]->temperature() != before[i])
+            wrong++;                                // took over the spare's ROM
+
+    sim.setAttached((int)((before[0] - expected_temperature(0)) / 0.25f), false);
+    int replace_calls = 0;
+    bool missed = false;
+    do {
+        DS1820::maintainBus(DATA_PIN);
+        missed = missed || !probes[0]->isPresent();
+    } while (!(missed && probes[0]->isPresent()) && ++replace_calls < calls);
+    probes[0]->convertTemperature(true, DS1820::this_device);
+    bool replaced = probes[0]->temperature() == expected_temperature(count);
+    printf("{\"bench\":\"hotplug\",\"probes\":%d,\"noise\":%g,\"maintain_calls\":%d,"
+           "\"presence_changes\":%d,\"wrong_adoptions\":%d,\"replace_calls\":%d,\"replaced\":%d}\n",
+           count, 0.005, calls, changes, wrong, replace_calls + 1, replaced ? 1 : 0);
+    for (int i = 0; i < count; i++)
+        delete probes[i];
+}
+
+static void bench_power() {
+// A battery node sampling once per minute, busy-waiting or sleeping between bursts
+    OneWireSim &sim = OneWireSim::bus();
+    const uint32_t period_ms = 60000;
+    const int count = 4, samples = 5;
+    DS1820 *probes[count];
+    sim.clear();
+    add_devices(count, FAMILY_CODE_DS18B20, 0);
+    for (int i = 0; i < count; i++)
+        probes[i] = new DS1820(DATA_PIN);
+    for (int low_power = 0; low_power < 2; low_power++) {
+        DS1820::setLowPower(low_power != 0);
+        DS1820Sampler sampler(probes, count, period_ms);
+        DS1820Sampler::reading readings[count];
+        sampler.sample(readings);           // the first sample starts the grid
+        DS1820::resetPowerCounters();
+        uint64_t start = sim.now();
+        for (int n = 0; n < samples; n++)
+            sampler.sample(readings);
+        uint64_t elapsed = sim.now() - start;
+        DS1820::power_counters power = DS1820::powerCounters();
+        printf("{\"bench\":\"power\",\"probes\":%d,\"period_ms\":%u,\"low_power\":%d,"
+               "\"awake_ms_per_sample\":%.3f,\"busy_ms_per_sample\":%.3f,\"awake_ratio\":%.5f,"
+               "\"missed_deadlines\":%u}\n",
+               count, period_ms, low_power, power.awake_us / 1000.0 / samples,
+               power.busy_us / 1000.0 / samples, (double)power.awake_us / elapsed, sampler.missedDeadlines());
+    }
+    DS1820::setLowPower(false);
+    for (int i = 0; i < count; i++)
+        delete probes[i];
+}
+
+#if DS1820_TRACE
+static FILE *trace_file;
+
+static void write_trace_file(const char *data, int length) {
+    fwrite(data, 1, length, trace_file);
+}
+
+static void bench_trace() {
+// A noisy sweep of a few probes, dumped for trace_replay
+    OneWireSim &sim = OneWireSim::bus();
+    const int count = 4;
+    DS1820 *probes[count];
+    sim.clear();
+    add_devices(count, FAMILY_CODE_DS18B20, 0);
+    for (int i = 0; i < count; i++)
+        probes[i] = new DS1820(DATA_PIN);
+    sim.setNoise(0.002, 7);
+    sim.resetCounters();
+    DS1820Trace::clear();
+    probes[0]->convertTemperature(true, DS1820::all_devices);
+    for (int i = 0; i < count; i++)
+        probes[i]->temperature();
+    sim.setNoise(0, 0);
+    trace_file = fopen("ds1820.trace", "wb");
+    if (trace_file != NULL) {
+        DS1820Trace::dump(write_trace_file);
+        fclose(trace_file);
+    }
+    printf("{\"bench\":\"trace\",\"probes\":%d,\"records\":%d,\"bit_errors\":%u,\"file\":\"ds1820.trace\"}\n",
+           count, DS1820Trace::count(), sim.stats().bit_errors);
+    for (int i = 0; i < count; i++)
+        delete probes[i];
+}
+#endif
+
+static void bench_cache() {
+// A loop that displays, logs and checks the temperature, i.e. three reads per iteration
+    OneWireSim &sim = OneWireSim::bus();
+    static const uint32_t max_ages_ms[] = {0, 1000};
+    sim.clear();
+    uint8_t ROM[8] = {FAMILY_CODE_DS18B20, 1, 2, 3, 4, 5, 6, 0};
+    sim.addDevice(ROM, 21.0f);
+    DS1820 probe(DATA_PIN);
+    for (size_t a = 0; a < sizeof(max_ages_ms) / sizeof(max_ages_ms[0]); a++) {
+        probe.setMaxAge(max_ages_ms[a]);
+        sim.resetCounters();
+        uint64_t start = sim.now();
+        for (int loop = 0; loop < SAMPLES; loop++) {
+            if (max_ages_ms[a] == 0)
+                probe.convertTemperature(true, DS1820::this_device);
+            for (int consumer = 0; consumer < 3; consumer++)
+                probe.temperature();
+            wait_ms(100);                   // the rest of the loop body
+        }
+        uint64_t elapsed = sim.now() - start;
+        printf("{\"bench\":\"cache\",\"max_age_ms\":%u,\"loops\":%d,\"loop_ms\":%.3f,"
+               "\"conversions_per_loop\":%.2f,\"scratchpad_reads_per_loop\":%.2f}\n",
+               max_ages_ms[a], SAMPLES, elapsed / 1000.0 / SAMPLES,
+               (double)sim.stats().commands[0x44] / SAMPLES, (double)sim.stats().commands[0xBE] / SAMPLES);
+    }
+    // A conversion started elsewhere (sampler, pipeline) is collected while the cached reading is fresh
+    const uint32_t collect_max_age_ms = 5000;
+    probe.setMaxAge(collect_max_age_ms);
+    probe.temperature();
+    sim.setTemperature(0, 22.0f);
+    probe.convertTemperature(true, DS1820::this_device);
+    bool collected = probe.temperature() == 22.0f;
+    printf("{\"bench\":\"cache_collect\",\"max_age_ms\":%u,\"collected\":%d,\"age_ms\":%u}\n",
+           collect_max_age_ms, collected ? 1 : 0, probe.readingAge());
+}
+
+static void bench_cpu() {
+    const int iterations = 1000000;
+    char RAM[9] = {0x50, 0x01, 0x4B, 0x46, 0x7F, (char)0xFF, 0x0C, 0x10, 0x00};
+    volatile float sink_f = 0;
+    volatile char sink_c = 0;
+
+    uint64_t start = cpu_ns();
+    for (int i = 0; i < iterations; i++) {
+        RAM[0] = i;
+        sink_f = sink_f + family_traits<FAMILY_CODE_DS18B20>::decode(RAM);
+    }
+    double decode = (double)(cpu_ns() - start) / iterations;
+
+    start = cpu_ns();
+    for (int i = 0; i < iterations; i++) {
+        RAM[0] = i;
+        sink_c = sink_c ^ DS1820::crc8(RAM, 8);
+    }
+    double crc = (double)(cpu_ns() - start) / iterations;
+
+    printf("{\"bench\":\"cpu\",\"decode_ns\":%.1f,\"scratchpad_crc_ns\":%.1f}\n", decode, crc);
+}
+
+int main() {
+#if DS1820_TRACE
+    bench_trace();      // the trace build only captures, its timing is not the library's
+    return 0;
+#endif
+    for (size_t i = 0; i < sizeof(probe_counts) / sizeof(probe_counts[0]); i++)
+        bench_sweeps(probe_counts[i]);
+    bench_mixed_bus();
+    bench_store();
+    bench_hotplug();
+    bench_power();
+    bench_cache();
+    bench_cpu();
+    return 0;
+}
@@ -0,0 +1,110 @@
+/* Host (Linux) stand-in for the parts of mbed used by the DS1820 library
+ *
+ * Pins and time are routed to the host_* hooks, OneWireSim.cpp implements them
+ * with a simulated 1-Wire bus and a virtual microsecond clock. Waiting only
+ * advances that clock, so benchmark results do not depend on the host. sleep()
+ * jumps the clock to the pending Timeout, which is the only wake-up source.
+ */
+
+#ifndef HOST_MBED_H
+#define HOST_MBED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+
+typedef int PinName;
+enum { NC = -1 };
+enum PinMode { PullNone, PullUp, PullDown, OpenDrain };
+
+void host_pin_output(PinName pin, bool output);
+void host_pin_write(PinName pin, int value);
+int host_pin_read(PinName pin);
+uint32_t host_time_us();
+void host_wait_us(uint32_t us);
+void host_sleep();
+void host_timeout_attach(void (*handler)(void), uint32_t us);
+void host_timeout_detach(void (*handler)(void));
+
+inline void wait_us(int us) { host_wait_us(us); }
+inline void wait_ms(int ms) { host_wait_us(ms * 1000); }
+inline void wait(float s) { host_wait_us((uint32_t)(s * 1000000.0f)); }
+inline void sleep() { host_sleep(); }
+
+inline void error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(1);
+}
+
+// PRIMASK is tracked so the simulator only stretches phases that run with interrupts
+// enabled, and can run an interrupt that became pending while they were masked
+void host_irq_enabled();
+inline uint32_t &host_primask() { static uint32_t primask = 0; return primask; }
+inline uint32_t __get_PRIMASK() { return host_primask(); }
+inline void __set_PRIMASK(uint32_t value) {
+    bool enabling = host_primask() != 0 && value == 0;
+    host_primask() = value;
+    if (enabling)
+        host_irq_enabled();
+}
+inline void __disable_irq() { host_primask() = 1; }
+inline void __enable_irq() { __set_PRIMASK(0); }
+inline void __NOP() {}
+
+class DigitalInOut {
+public:
+    DigitalInOut(PinName pin) : _pin(pin) {}
+    void output() { host_pin_output(_pin, true); }
+    void input() { host_pin_output(_pin, false); }
+    void write(int value) { host_pin_write(_pin, value); }
+    int read() { return host_pin_read(_pin); }
+    void mode(PinMode) {}
+    DigitalInOut &operator= (int value) { write(value); return *this; }
+    operator int() { return read(); }
+private:
+    PinName _pin;
+};
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin) : _pin(pin), _value(0) {}
+    void write(int value) { _value = value; }
+    int read() { return _value; }
+    DigitalOut &operator= (int value) { write(value); return *this; }
+    operator int() { return read(); }
+private:
+    PinName _pin;
+    int _value;
+};
+
+class Timeout {
+public:
+    Timeout() : _handler(NULL) {}
+    ~Timeout() { detach(); }
+    void attach_us(void (*handler)(void), uint32_t us) { detach(); _handler = handler; host_timeout_attach(handler, us); }
+    void detach() { if (_handler) host_timeout_detach(_handler); _handler = NULL; }
+private:
+    void (*_handler)(void);
+};
+
+class Timer {
+public:
+    Timer() : _start(0), _elapsed(0), _running(false) {}
+    void start() { if (!_running) { _start = host_time_us(); _running = true; } }
+    void stop() { if (_running) { _elapsed += host_time_us() - _start; _running = false; } }
+    void reset() { _elapsed = 0; _start = host_time_us(); }
+    int read_us() { return _elapsed + (_running ? host_time_us() - _start : 0); }
+    int read_ms() { return read_us() / 1000; }
+    float read() { return read_us() / 1000000.0f; }
+private:
+    uint32_t _start, _elapsed;
+    bool _running;
+};
+
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for mbed's us_ticker_api.h, see mbed.h in this directory */
+
+#ifndef HOST_US_TICKER_API_H
+#define HOST_US_TICKER_API_H
+
+#include "mbed.h"
+
+inline uint32_t us_ticker_read() { return host_time_us(); }
+
+#endif
@@ -0,0 +1,18 @@
+/* RAM taken by the DS1820 objects on the target, see "make sizes"
+ *
+ * Compiled, not linked, for 32 bit pointers against target/mbed.h, which lays
+ * out the pin objects like mbed classic on the nRF51. Each size is the length
+ * of one of the arrays below and is read back from the object file with nm.
+ */
+
+#include "mbed.h"
+#include "DS1820.h"
+
+struct DS1820SizeReport {
+    static const int probe_bytes = sizeof(DS1820);
+    static const int bus_bytes = sizeof(DS1820::bus);
+};
+
+char ds1820_pointer_bytes[sizeof(void *)];
+char ds1820_probe_bytes[DS1820SizeReport::probe_bytes];
+char ds1820_bus_bytes[DS1820SizeReport::bus_bytes];
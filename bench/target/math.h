@@ -0,0 +1,8 @@
+/* Freestanding stand-in for <math.h>, declares what DS1820Family.h uses */
+
+#ifndef TARGET_MATH_H
+#define TARGET_MATH_H
+
+extern "C" double floor(double x);
+
+#endif
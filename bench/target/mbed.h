@@ -0,0 +1,45 @@
+/* Size-only stand-in for mbed classic on the nRF51 (micro:bit), see sizes.cpp
+ *
+ * Declares just what DS1820.h needs, with the data layout of the real classes:
+ * PinName is an enum and DigitalInOut and DigitalOut each hold a gpio_t.
+ * Nothing here is ever linked.
+ */
+
+#ifndef TARGET_MBED_H
+#define TARGET_MBED_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum { NC = (int)0xFFFFFFFF } PinName;
+
+typedef struct {                // TARGET_MCU_NRF51822/gpio_object.h
+    PinName pin;
+    uint32_t mask;
+} gpio_t;
+
+class DigitalInOut {
+public:
+    DigitalInOut(PinName pin);
+    void output();
+    void input();
+    void write(int value);
+    int read();
+    DigitalInOut &operator= (int value);
+    operator int();
+protected:
+    gpio_t gpio;
+};
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin);
+    void write(int value);
+    int read();
+    DigitalOut &operator= (int value);
+    operator int();
+protected:
+    gpio_t gpio;
+};
+
+#endif
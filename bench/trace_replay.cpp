@@ -0,0 +1,336 @@
+/* Replays a DS1820 slot trace (see source/DS1820Trace.h) on the simulated bus
+ *
+ *   trace_replay <dump file>
+ *
+ * The trace is decoded first: ROM commands, function commands and scratchpad
+ * reads, which gives the ROM code and a valid scratchpad of every device that
+ * was talked to. Those devices are put on the simulated bus and the master side
+ * of the trace is replayed with its original timing. A presence pulse or read
+ * slot that came out different from what the simulated devices answer is
+ * reported with its record number, i.e. the slot that went wrong on the real
+ * bus. Scratchpads are decoded with the library's family traits.
+ *
+ * Output is one JSON object per line on stdout.
+ */
+
+#include "mbed.h"
+#include "DS1820Family.h"
+#include "DS1820Trace.h"
+#include "OneWireSim.h"
+#include <string.h>
+#include <map>
+#include <vector>
+
+// Slot lengths as driven by DS1820.cpp, a record is taken at the end of its slot
+#define RESET_US    1000
+#define WRITE1_US   58
+#define WRITE0_US   68
+#define READ_US     58
+
+struct device_info {
+    uint8_t ROM[8];
+    uint8_t scratchpad[9];
+    bool scratchpad_valid;
+    bool parasite;
+};
+
+static std::vector<trace_record> records;
+static std::map<uint64_t, device_info> devices;
+static const uint8_t unknown_ROM[8] = {FAMILY_CODE_DS18B20, 0, 0, 0, 0, 0, 0, 0};
+
+static uint64_t ROM_key(const uint8_t *ROM) {
+    uint64_t key = 0;
+    for (int i = 7; i >= 0; i--)
+        key = (key << 8) | ROM[i];
+    return key;
+}
+
+static const family_ops *family_for(uint8_t code) {
+    switch (code) {
+        case FAMILY_CODE_DS1820:    return family_ops_for<FAMILY_CODE_DS1820>();
+        case FAMILY_CODE_DS18B20:   return family_ops_for<FAMILY_CODE_DS18B20>();
+        case FAMILY_CODE_DS1822:    return family_ops_for<FAMILY_CODE_DS1822>();
+        case FAMILY_CODE_MAX31850:  return family_ops_for<FAMILY_CODE_MAX31850>();
+        default:                    return NULL;
+    }
+}
+
+static void print_ROM(const uint8_t *ROM) {
+    for (int i = 0; i < 8; i++)
+        printf("%02x", ROM[i]);
+}
+
+static bool load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    uint8_t header[8], bytes[4];
+    if (fread(header, 1, 8, file) != 8 || memcmp(header, "1WTR", 4) != 0 ||
+        header[4] != DS1820_TRACE_VERSION || header[5] != 4) {
+        fprintf(stderr, "%s: not a version %d DS1820 trace\n", path, DS1820_TRACE_VERSION);
+        fclose(file);
+        return false;
+    }
+    int count = header[6] | (header[7] << 8);
+    for (int i = 0; i < count && fread(bytes, 1, 4, file) == 4; i++) {
+        trace_record r = {(uint16_t)(bytes[0] | (bytes[1] << 8)), bytes[2], bytes[3]};
+        records.push_back(r);
+    }
+    fclose(file);
+    if ((int)records.size() != count)
+        fprintf(stderr, "%s: truncated, %u of %d records\n", path, (unsigned)records.size(), count);
+    return true;
+}
+
+/* Follows the transactions in the trace, one slot at a time */
+class decoder {
+public:
+    int scratchpads, crc_failures;
+
+    decoder() : scratchpads(0), crc_failures(0), _state(unknown) {}
+
+    void slot(int index, const trace_record &r) {
+        if (r.kind == trace_reset) {
+            _state = r.value ? rom_command : unknown;
+            _bits = 0;
+            _byte = 0;
+            _ROM_known = false;
+            return;
+        }
+        bool bit = r.value != 0;
+        switch (_state) {
+            case rom_command:
+                if (r.kind == trace_write && shift_in(bit)) {
+                    _bits = 0;
+                    memset(_ROM, 0, 8);
+                    if (_byte == 0xF0) {
+                        _state = search;
+                    } else if (_byte == 0x55) {
+                        _state = match;
+                    } else if (_byte == 0xCC) {
+                        _state = function_command;
+                        _byte = 0;
+                    } else {
+                        _state = unknown;
+                    }
+                }
+                break;
+            case search:
+                if (r.kind == trace_write && ROM_bit(bit)) {
+                    _state = unknown;       // the library resets after every search pass
+                }
+                break;
+            case match:
+                if (r.kind == trace_write && ROM_bit(bit)) {
+                    _state = function_command;
+                    _bits = 0;
+                    _byte = 0;
+                }
+                break;
+            case function_command:
+                if (r.kind == trace_write && shift_in(bit)) {
+                    _command = _byte;
+                    _state = (_command == 0xBE || _command == 0xB4) ? data : unknown;
+                    _bits = 0;
+                    _start = index;
+                    memset(_data, 0, sizeof(_data));
+                }
+                break;
+            case data:
+                if (r.kind != trace_read)
+                    break;
+                if (_command == 0xB4) {
+                    device(_ROM_known ? _ROM : unknown_ROM)->parasite = !bit;
+                    _state = unknown;
+                    break;
+                }
+                if (bit)
+                    _data[_bits >> 3] |= 1 << (_bits & 7);
+                if (++_bits == 72) {
+                    scratchpad();
+                    _state = unknown;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+private:
+    enum phase { unknown, rom_command, search, match, function_command, data };
+
+    bool shift_in(bool bit) {
+        _byte = (_byte >> 1) | (bit ? 0x80 : 0);
+        return ++_bits == 8;
+    }
+
+    bool ROM_bit(bool bit) {
+        if (bit)
+            _ROM[_bits >> 3] |= 1 << (_bits & 7);
+        if (++_bits < 64)
+            return false;
+        _ROM_known = OneWireSim::crc8(_ROM, 7) == _ROM[7];
+        if (_ROM_known)
+            device(_ROM);
+        return true;
+    }
+
+    device_info *device(const uint8_t *ROM) {
+        uint64_t key = ROM_key(ROM);
+        if (devices.find(key) == devices.end()) {
+            device_info info;
+            memset(&info, 0, sizeof(info));
+            memcpy(info.ROM, ROM, 8);
+            devices[key] = info;
+        }
+        return &devices[key];
+    }
+
+    void scratchpad() {
+        const uint8_t *ROM = _ROM_known ? _ROM : unknown_ROM;
+        const family_ops *family = family_for(ROM[0]);
+        bool crc_ok = OneWireSim::crc8(_data, 8) == _data[8];
+        scratchpads++;
+        printf("{\"replay\":\"scratchpad\",\"record\":%d,\"rom\":\"", _start);
+        print_ROM(ROM);
+        printf("\",\"crc_ok\":%s", crc_ok ? "true" : "false");
+        if (crc_ok && family != NULL)
+            printf(",\"temperature\":%.4f", family->decode((const char *)_data));
+        printf("}\n");
+        if (!crc_ok) {
+            crc_failures++;
+            return;
+        }
+        device_info *info = device(ROM);
+        if (!info->scratchpad_valid) {
+            memcpy(info->scratchpad, _data, 9);
+            info->scratchpad_valid = true;
+        }
+    }
+
+    phase _state;
+    int _bits, _start;
+    uint8_t _byte, _command;
+    uint8_t _ROM[8];
+    bool _ROM_known;
+    uint8_t _data[9];
+};
+
+static int replay_slot(OneWireSim &sim, const trace_record &r) {
+// Drives one slot the way DS1820.cpp does, returns what the bus answered
+    int answer = r.value;
+    switch (r.kind) {
+        case trace_reset:
+            sim.pinOutput(true);
+            sim.pinWrite(0);
+            sim.advance(500);
+            sim.pinOutput(false);
+            sim.advance(90);
+            answer = sim.pinRead() == 0;
+            sim.advance(410);
+            break;
+        case trace_write:
+            sim.pinOutput(true);
+            sim.pinWrite(0);
+            sim.advance(3);
+            if (r.value) {
+                sim.pinWrite(1);
+                sim.advance(55);
+            } else {
+                sim.advance(55);
+                sim.pinWrite(1);
+                sim.advance(10);
+            }
+            break;
+        case trace_read:
+            sim.pinOutput(true);
+            sim.pinWrite(0);
+            sim.advance(3);
+            sim.pinOutput(false);
+            sim.advance(10);
+            answer = sim.pinRead();
+            sim.advance(45);
+            break;
+    }
+    return answer;
+}
+
+static uint32_t slot_us(const trace_record &r) {
+    switch (r.kind) {
+        case trace_reset:   return RESET_US;
+        case trace_write:   return r.value ? WRITE1_US : WRITE0_US;
+        case trace_read:    return READ_US;
+        default:            return 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace dump>\n", argv[0]);
+        return 2;
+    }
+    if (!load(argv[1]))
+        return 1;
+
+    decoder decode;
+    int overruns = 0, crc_errors = 0, resets = 0, slots = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].kind == trace_overrun)
+            overruns++;
+        else if (records[i].kind == trace_crc_error)
+            crc_errors++;
+        else
+            decode.slot(i, records[i]);
+    }
+
+    OneWireSim &sim = OneWireSim::bus();
+    sim.clear();
+    for (std::map<uint64_t, device_info>::iterator d = devices.begin(); d != devices.end(); d++) {
+        uint8_t ROM[8];
+        memcpy(ROM, d->second.ROM, 8);
+        int index = sim.addDevice(ROM, 0);
+        if (d->second.scratchpad_valid)
+            sim.setScratchpad(index, d->second.scratchpad);
+        sim.setParasite(index, d->second.parasite);
+    }
+
+    // The master side is replayed from the first reset on, the devices' state is unknown before
+    int mismatches = 0;
+    bool started = false, overrun = false;
+    uint64_t end = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        const trace_record &r = records[i];
+        end += r.delta_us;
+        if (r.kind == trace_overrun) {
+            overrun = true;
+            continue;
+        }
+        if (r.kind == trace_crc_error)
+            continue;
+        started = started || r.kind == trace_reset;
+        if (!started)
+            continue;
+        if (r.kind == trace_reset)
+            resets++;
+        else
+            slots++;
+        if (end > sim.now() + slot_us(r))
+            sim.advance(end - sim.now() - slot_us(r));
+        int answer = replay_slot(sim, r);
+        if (answer != r.value) {
+            mismatches++;
+            printf("{\"replay\":\"mismatch\",\"record\":%u,\"slot\":\"%s\",\"traced\":%d,\"simulated\":%d,"
+                   "\"overrun\":%s}\n", (unsigned)i, r.kind == trace_reset ? "reset" : "read",
+                   r.value, answer, overrun ? "true" : "false");
+        }
+        overrun = false;
+    }
+
+    printf("{\"replay\":\"summary\",\"records\":%u,\"devices\":%u,\"resets\":%d,\"slots\":%d,"
+           "\"overruns\":%d,\"crc_errors\":%d,\"scratchpads\":%d,\"crc_failures\":%d,\"mismatches\":%d}\n",
+           (unsigned)records.size(), (unsigned)devices.size(), resets, slots,
+           overruns, crc_errors, decode.scratchpads, decode.crc_failures, mismatches);
+    return 0;
+}
@@ -3,6 +3,10 @@
 
 using namespace pxt;
 
+#define DS1820_EVT_ID         0x1820
+#define DS1820_EVT_BUS_FREE   1
+#define DS1820_EVT_SWEEP_DONE 2
+
 enum class Pins{
   P0=  3,
   P1=  2,
@@ -30,6 +34,59 @@ enum class Pins{
 namespace DS1820pxt { 
 
   DS1820 *probe;
+  PinName probe_pin;
+  int max_age = 1000;
+
+  // Fibers only switch when one of them sleeps or waits, so bus work that does not
+  // yield is atomic already. The arbiter covers everything else: fibers queue on
+  // the bus and a sweep (convert + read) in progress is shared with every fiber
+  // that asks for a fresh reading meanwhile.
+  struct BusArbiter {
+    bool busy;
+    bool sweeping;
+    uint16_t sweeps;            // completed sweeps
+    int value;                  // result of the last sweep
+  };
+  BusArbiter bus;
+
+  void acquire() {
+    while (bus.busy) fiber_wait_for_event(DS1820_EVT_ID, DS1820_EVT_BUS_FREE);
+    bus.busy = true;
+  }
+
+  void release() {
+    bus.busy = false;
+    MicroBitEvent(DS1820_EVT_ID, DS1820_EVT_BUS_FREE);
+  }
+
+  int sweep() {
+    if (bus.sweeping) {
+      uint16_t joined = bus.sweeps;
+      while (bus.sweeps == joined) fiber_wait_for_event(DS1820_EVT_ID, DS1820_EVT_SWEEP_DONE);
+      return bus.value;
+    }
+    bus.sweeping = true;
+    acquire();
+    int delay = probe->convertTemperature(false, DS1820::all_devices);
+    release();
+    if (delay > 0) fiber_sleep(delay);   // the bus is free for others during the conversion
+    acquire();
+    bus.value = (int)(probe->temperature() * 10.0);
+    release();
+    bus.sweeping = false;
+    bus.sweeps++;
+    MicroBitEvent(DS1820_EVT_ID, DS1820_EVT_SWEEP_DONE);
+    return bus.value;
+  }
+
+  void maintenance() {
+    while (probe != NULL) {
+      fiber_sleep(5000);
+      acquire();
+      DS1820::maintainBus(probe_pin);
+      release();
+    }
+  }
 
   /**
   * initialises local variablesssss
@@ -37,9 +94,23 @@ namespace DS1820pxt {
   //% blockId=probe_init
   //% block="connect temperature probe to %pin"
   void init(Pins pin){
+    acquire();
+    if (probe != NULL && probe_pin == (PinName)pin) {
+      // Already connected, just pick up a probe that was swapped meanwhile. Asked
+      // explicitly, so do not wait for the maintenance fiber to see it missing. The
+      // first call only consumes a reading taken before the swap
+      for (int i = 0; i <= DS1820_REPLACE_MISSES; i++)
+        DS1820::maintainBus(probe_pin);
+      release();
+      return;
+    }
+    bool start_maintenance = probe == NULL;
     if (probe != NULL) delete(probe);
-    probe = new DS1820((PinName)pin);
-    probe->convertTemperature(true, DS1820::all_devices);
+    probe_pin = (PinName)pin;
+    probe = new DS1820(probe_pin);
+    probe->setMaxAge(max_age);
+    release();
+    if (start_maintenance) create_fiber(maintenance);
   }
 
   /**
@@ -48,8 +119,27 @@ namespace DS1820pxt {
   //% blockId = get_temp
   //% block="temperature"
   int temp1dp() {
-    probe->convertTemperature(true, DS1820::all_devices);
-    uBit.sleep(20);
-    return ((int)(probe->temperature() * 10.0));
+    if (max_age == 0 || probe->readingAge() > (uint32_t)max_age) return sweep();
+    return ((int)(probe->temperature() * 10.0));   // fresh, served from memory
+  }
+
+  /**
+   * set how old (in ms) the temperature may be before the probe is read again, 0 to always read
+   */
+  //% blockId=probe_max_age
+  //% block="set temperature max age to %ms|ms"
+  void setMaxAge(int ms) {
+    max_age = ms < 0 ? 0 : ms;
+    if (probe != NULL) probe->setMaxAge(max_age);
+  }
+
+  /**
+   * age of the last temperature in ms, -1 if there is none yet
+   */
+  //% blockId=probe_age
+  //% block="temperature age (ms)"
+  int readingAge() {
+    if (probe == NULL) return -1;
+    return (int)probe->readingAge();
   }
 }
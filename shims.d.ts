@@ -19,6 +19,20 @@ declare namespace DS1820pxt {
     //% blockId = get_temp
     //% block="temperature" shim=DS1820pxt::temp1dp
     function temp1dp(): number;
+
+    /**
+     * set how old (in ms) the temperature may be before the probe is read again, 0 to always read
+     */
+    //% blockId=probe_max_age
+    //% block="set temperature max age to %ms|ms" shim=DS1820pxt::setMaxAge
+    function setMaxAge(ms: number): void;
+
+    /**
+     * age of the last temperature in ms, -1 if there is none yet
+     */
+    //% blockId=probe_age
+    //% block="temperature age (ms)" shim=DS1820pxt::readingAge
+    function readingAge(): number;
 }
 
 // Auto-generated. Do not edit. Really.
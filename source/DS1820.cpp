@@ -1,4 +1,10 @@
 #include "DS1820.h"
+#include "DS1820Trace.h"
+#include "us_ticker_api.h"
+#include <string.h>
+
+// Busy-wait time not yet added to the power counters, see power_update
+static uint32_t busy_pending_us = 0;
 
 #ifdef TARGET_STM
 //STM targets use opendrain mode since their switching between input and output is slow
@@ -23,9 +29,10 @@ void init_soft_delay( void ) {
         loops_per_us = 1;
         Timer timey; 
         timey.start();
-        ONEWIRE_DELAY_US(320000);                     
+        ONEWIRE_DELAY_US(320000);                     // 10000 loops, a few ms
         timey.stop();
         loops_per_us = (320000 + timey.read_us() / 2) / timey.read_us();  
+        busy_pending_us += timey.read_us();
     }
 }
 #else
@@ -33,37 +40,150 @@ void init_soft_delay( void ) {
     #define ONEWIRE_DELAY_US(value) wait_us(value)
 #endif
 
-LinkedList<node> DS1820::probes;
+#ifdef TARGET_NORDIC
+//NORDIC us_ticker runs from the 32kHz RTC, so a measured interval can be one tick long
+    #define ONEWIRE_TICK_SLACK_US   31
+#else
+    #define ONEWIRE_TICK_SLACK_US   1
+#endif
+
+// Only the timing-critical part of a slot (falling edge to release or sample) runs
+// with interrupts masked, they are re-enabled during the recovery time between slots.
+#define ONEWIRE_CRITICAL_ENTER(state)   state = __get_PRIMASK(); __disable_irq()
+#define ONEWIRE_CRITICAL_EXIT(state)    __set_PRIMASK(state)
+
+#define ONEWIRE_RESET_LOW_MAX_US    960     // longer and some devices see a power-on reset
+#define ONEWIRE_WRITE0_LOW_MAX_US   120     // tLOW0 upper limit
+#define ONEWIRE_RETRIES             3       // attempts per transaction before giving up
+
+// Slot lengths for the power counters, added once per slot outside the timed part
+#define ONEWIRE_RESET_US            1000
+#define ONEWIRE_WRITE1_US           58
+#define ONEWIRE_WRITE0_US           68
+#define ONEWIRE_READ_US             58
+
+// Set when an interrupt stretched an unmasked slot phase past its window, the
+// running transaction is then repeated instead of waiting for a CRC failure.
+static volatile bool slot_overrun = false;
+
+static void check_slot_window(uint32_t low_us, uint32_t max_us) {
+// Called with interrupts enabled, the trace record is too slow for a masked phase
+    if (low_us > max_us + ONEWIRE_TICK_SLACK_US) {
+        slot_overrun = true;
+        ONEWIRE_TRACE(trace_overrun, 0);
+    }
+}
+
+// Waits shorter than this are not worth a sleep and wake-up
+#define LOW_POWER_MIN_US    2000
+
+DS1820::bus *DS1820::buses = NULL;
+
+static bool low_power = false;
+static volatile bool idle_woken;
+static uint32_t power_last = 0;             // us_ticker time the counters were last brought up to date
+static DS1820::power_counters power_stats = {0, 0, 0};
+
+// Family codes the ROM search looks for, 0 terminated
+static const char family_codes[] = {
+#if DS1820_FAMILY_DS1820
+    FAMILY_CODE_DS1820,
+#endif
+#if DS1820_FAMILY_DS18B20
+    FAMILY_CODE_DS18B20,
+#endif
+#if DS1820_FAMILY_DS1822
+    FAMILY_CODE_DS1822,
+#endif
+#if DS1820_FAMILY_MAX31850
+    FAMILY_CODE_MAX31850,
+#endif
+    0
+};
+
+const family_ops *DS1820::family_lookup(char family_code) {
+// Only the families enabled in DS1820Family.h are compiled in
+    switch (family_code) {
+#if DS1820_FAMILY_DS1820
+        case FAMILY_CODE_DS1820:    return family_ops_for<FAMILY_CODE_DS1820>();
+#endif
+#if DS1820_FAMILY_DS18B20
+        case FAMILY_CODE_DS18B20:   return family_ops_for<FAMILY_CODE_DS18B20>();
+#endif
+#if DS1820_FAMILY_DS1822
+        case FAMILY_CODE_DS1822:    return family_ops_for<FAMILY_CODE_DS1822>();
+#endif
+#if DS1820_FAMILY_MAX31850
+        case FAMILY_CODE_MAX31850:  return family_ops_for<FAMILY_CODE_MAX31850>();
+#endif
+        default:                    return NULL;
+    }
+}
  
  
-DS1820::DS1820 (PinName data_pin, PinName power_pin, bool power_polarity) : _datapin(data_pin), _parasitepin(power_pin) {
-    int byte_counter;
-    _power_polarity = power_polarity;
+DS1820::bus::bus(PinName data_pin, PinName power_pin, bool power_polarity) : datapin(data_pin), parasitepin(power_pin) {
+    pin = data_pin;
+    power_mosfet = power_pin != NC;
+    this->power_polarity = power_polarity;
+    probes = NULL;
+    next = NULL;
+    ONEWIRE_INIT((&datapin));
+}
 
-    _power_mosfet = power_pin != NC;
-    
-    for(byte_counter=0;byte_counter<9;byte_counter++)
-        RAM[byte_counter] = 0x00;
-    
-    ONEWIRE_INIT((&_datapin));
+DS1820::bus *DS1820::find_bus(PinName pin) {
+    for (bus *b = buses; b != NULL; b = b->next) {
+        if (b->pin == pin)
+            return b;
+    }
+    return NULL;
+}
+
+DS1820::DS1820 (PinName data_pin, PinName power_pin, bool power_polarity) {
+    // The packed state plus three pointers, padded to pointer alignment
+    static_assert(sizeof(DS1820) <= (sizeof(probe_state) + 4 * sizeof(void *) - 1) / sizeof(void *) * sizeof(void *),
+                  "DS1820 exceeds its RAM budget");
+    memset(&_state, 0, sizeof(_state));
+    _next = NULL;
+    _family = NULL;
+
+    _bus = find_bus(data_pin);
+    if (_bus == NULL) {
+        _bus = new bus(data_pin, power_pin, power_polarity);
+        _bus->next = buses;
+        buses = _bus;
+    }
     INIT_DELAY;
     
-    if (!unassignedProbe(&_datapin, _ROM))
+    if (!unassignedProbe(&_bus->datapin, _state.ROM))
         error("No unassigned DS1820 found!\n");
     else {
-        _datapin.input();
-        probes.append(this);
-        _parasite_power = !read_power_supply();
+        _bus->datapin.input();
+        _family = family_lookup(FAMILY_CODE);
+        DS1820 **link = &_bus->probes;
+        while (*link != NULL)
+            link = &(*link)->_next;
+        *link = this;
+        _state.parasite_power = !read_power_supply();
     }
 }
 
 DS1820::~DS1820 (void) {
-    node *tmp;
-    for(int i=1; i<=probes.length(); i++)
-    {
-        tmp = probes.pop(i);
-        if (tmp->data == this)
-            probes.remove(i);
+    DS1820 **link;
+    for (link = &_bus->probes; *link != NULL; link = &(*link)->_next) {
+        if (*link == this) {
+            *link = _next;
+            break;
+        }
+    }
+    if (_bus->probes == NULL) {     // last probe on this pin, the bus goes too
+        bus **bus_link;
+        for (bus_link = &buses; *bus_link != NULL; bus_link = &(*bus_link)->next) {
+            if (*bus_link == _bus) {
+                *bus_link = _bus->next;
+                break;
+            }
+        }
+        delete _bus;
     }
 }
 
@@ -71,48 +191,69 @@ DS1820::~DS1820 (void) {
 bool DS1820::onewire_reset(DigitalInOut *pin) {
 // This will return false if no devices are present on the data bus
     bool presence=false;
+    uint32_t irq_state, start, low_us;
     ONEWIRE_OUTPUT(pin);
     pin->write(0);          // bring low for 500 us
+    start = us_ticker_read();
     ONEWIRE_DELAY_US(500);
+    ONEWIRE_CRITICAL_ENTER(irq_state);
     ONEWIRE_INPUT(pin);       // let the data line float high
+    low_us = us_ticker_read() - start;
     ONEWIRE_DELAY_US(90);            // wait 90us
     if (pin->read()==0) // see if any devices are pulling the data line low
         presence=true;
+    ONEWIRE_CRITICAL_EXIT(irq_state);
+    check_slot_window(low_us, ONEWIRE_RESET_LOW_MAX_US);
     ONEWIRE_DELAY_US(410);
+    busy_pending_us += ONEWIRE_RESET_US;
+    ONEWIRE_TRACE(trace_reset, presence);
     return presence;
 }
  
 void DS1820::onewire_bit_out (DigitalInOut *pin, bool bit_data) {
+    uint32_t irq_state, start;
+    ONEWIRE_CRITICAL_ENTER(irq_state);
     ONEWIRE_OUTPUT(pin);
     pin->write(0);
+    start = us_ticker_read();           // before the exit, an interrupt pending meanwhile runs there
     ONEWIRE_DELAY_US(3);                 // DXP modified from 5
     if (bit_data) {
         pin->write(1); // bring data line high
+        ONEWIRE_CRITICAL_EXIT(irq_state);
         ONEWIRE_DELAY_US(55);
     } else {
+        ONEWIRE_CRITICAL_EXIT(irq_state);    // a late release still reads as 0, so only check the window
         ONEWIRE_DELAY_US(55);            // keep data line low
         pin->write(1);
+        check_slot_window(us_ticker_read() - start, ONEWIRE_WRITE0_LOW_MAX_US);
         ONEWIRE_DELAY_US(10);            // DXP added to allow bus to float high before next bit_out
     }
+    busy_pending_us += bit_data ? ONEWIRE_WRITE1_US : ONEWIRE_WRITE0_US;
+    ONEWIRE_TRACE(trace_write, bit_data);
 }
  
 void DS1820::onewire_byte_out(char data) { // output data character (least sig bit first).
     int n;
     for (n=0; n<8; n++) {
-        onewire_bit_out(&this->_datapin, data & 0x01);
+        onewire_bit_out(&_bus->datapin, data & 0x01);
         data = data >> 1; // now the next bit is in the least sig bit position.
     }
 }
  
 bool DS1820::onewire_bit_in(DigitalInOut *pin) {
     bool answer;
+    uint32_t irq_state;
+    ONEWIRE_CRITICAL_ENTER(irq_state);
     ONEWIRE_OUTPUT(pin);
     pin->write(0);
     ONEWIRE_DELAY_US(3);                 // DXP modofied from 5
     ONEWIRE_INPUT(pin);
     ONEWIRE_DELAY_US(10);                // DXP modified from 5
     answer = pin->read();
+    ONEWIRE_CRITICAL_EXIT(irq_state);
     ONEWIRE_DELAY_US(45);                // DXP modified from 50
+    busy_pending_us += ONEWIRE_READ_US;
+    ONEWIRE_TRACE(trace_read, answer);
     return answer;
 }
  
@@ -121,7 +262,7 @@ char DS1820::onewire_byte_in() { // read byte, least sig byte first
     int i;
     for (i=0; i<8; i++) {
         answer = answer >> 1; // shift over to make room for the next bit
-        if (onewire_bit_in(&this->_datapin))
+        if (onewire_bit_in(&_bus->datapin))
             answer = answer | 0x80; // if the data port is high, make this bit a 1
     }
     return answer;
@@ -139,134 +280,246 @@ bool DS1820::unassignedProbe(DigitalInOut *pin, char *ROM_address) {
     return search_ROM_routine(pin, 0xF0, ROM_address);
 }
  
-bool DS1820::search_ROM_routine(DigitalInOut *pin, char command, char *ROM_address) {
-    bool DS1820_done_flag = false;
-    int DS1820_last_descrepancy = 0;
-    char DS1820_search_ROM[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-    
-    int descrepancy_marker, ROM_bit_index;
-    bool return_value, Bit_A, Bit_B;
-    char byte_counter, bit_mask;
+int DS1820::foreignDevices(PinName pin, char (*ROM_addresses)[8], int max) {
+    DigitalInOut _pin(pin);
+    ONEWIRE_INIT((&_pin));
+    INIT_DELAY;
+    search_state state = {{0, 0, 0, 0, 0, 0, 0, 0}, 0, 0};
+    int count = 0;
+    do {
+        if (!search_ROM_pass(&_pin, 0xF0, &state))
+            break;
+        if (family_lookup(state.ROM[0]) == NULL) {
+            if (count < max) {
+                for(int byte_counter=0;byte_counter<8;byte_counter++)
+                    ROM_addresses[count][byte_counter] = state.ROM[byte_counter];
+            }
+            count++;
+        }
+    } while (state.last_discrepancy != 0);
+    return count;
+}
  
-    return_value=false;
-    while (!DS1820_done_flag) {
-        if (!onewire_reset(pin)) {
+bool DS1820::search_ROM_routine(DigitalInOut *pin, char command, char *ROM_address) {
+// Each enabled family is searched as its own branch, devices of other families drop
+// out of a pass after the family byte and never become DS1820 objects.
+    for (const char *family = family_codes; *family != 0; family++) {
+        search_state state = {{*family, 0, 0, 0, 0, 0, 0, 0}, 0, 8};
+        if (search_unassigned(pin, command, &state, ROM_address))
+            return true;
+    }
+    return false;
+}
+
+bool DS1820::search_unassigned(DigitalInOut *pin, char command, search_state *state, char *ROM_address) {
+// Walks the (sub)tree in state until a ROM is found that has no DS1820 object yet
+    int byte_counter;
+    do {
+        if (!search_ROM_pass(pin, command, state))
             return false;
-        } else {
-            ROM_bit_index=1;
-            descrepancy_marker=0;
-            char command_shift = command;
-            for (int n=0; n<8; n++) {           // Search ROM command or Search Alarm command
-                onewire_bit_out(pin, command_shift & 0x01);
-                command_shift = command_shift >> 1; // now the next bit is in the least sig bit position.
-            } 
-            byte_counter = 0;
+        if (find_probe(state->ROM) == NULL) {
+            for(byte_counter=0;byte_counter<8;byte_counter++)
+                ROM_address[byte_counter] = state->ROM[byte_counter];
+            return true;
+        }
+    } while (state->last_discrepancy != 0);
+    return false;
+}
+
+bool DS1820::search_ROM_pass(DigitalInOut *pin, char command, search_state *state) {
+    search_state saved = *state;    // the walk rewrites the ROM bits it follows
+    int retries = 0;
+    bool found;
+    do {
+        slot_overrun = false;
+        *state = saved;             // repeat this pass, it walks the same branch again
+        found = search_ROM_walk(pin, command, state);
+    } while (slot_overrun && ++retries < ONEWIRE_RETRIES);
+    return found;
+}
+
+bool DS1820::search_ROM_walk(DigitalInOut *pin, char command, search_state *state) {
+// One pass down the search tree. The first prefix_bits of state->ROM are forced, so only
+// devices under that prefix take part. Returns false if there is no such device or on CRC error.
+    int descrepancy_marker, ROM_bit_index, byte_counter;
+    bool Bit_A, Bit_B, ROM_bit;
+    char bit_mask;
+ 
+    if (!onewire_reset(pin))
+        return false;
+    descrepancy_marker=0;
+    char command_shift = command;
+    for (int n=0; n<8; n++) {           // Search ROM command or Search Alarm command
+        onewire_bit_out(pin, command_shift & 0x01);
+        command_shift = command_shift >> 1; // now the next bit is in the least sig bit position.
+    } 
+    byte_counter = 0;
+    bit_mask = 0x01;
+    for (ROM_bit_index=1; ROM_bit_index<=64; ROM_bit_index++) {
+        Bit_A = onewire_bit_in(pin);
+        Bit_B = onewire_bit_in(pin);
+        if (Bit_A & Bit_B)
+            return false;               // nobody answered, no device (left) on this branch
+        ROM_bit = state->ROM[byte_counter] & bit_mask;
+        if (Bit_A | Bit_B) {
+            if ((ROM_bit_index <= state->prefix_bits) && (Bit_A != ROM_bit))
+                return false;           // all remaining devices are outside the prefix
+            ROM_bit = Bit_A;
+        } else if (ROM_bit_index > state->prefix_bits) {
+            // both bits A and B are low, so there are two or more devices present
+            if ( ROM_bit_index == state->last_discrepancy ) {
+                ROM_bit = true;
+            } else if ( ROM_bit_index > state->last_discrepancy ) {
+                ROM_bit = false;
+                descrepancy_marker = ROM_bit_index;
+            } else if (!ROM_bit) {
+                descrepancy_marker = ROM_bit_index;
+            }
+        }
+        if (ROM_bit)
+            state->ROM[byte_counter] = state->ROM[byte_counter] | bit_mask; // Set ROM bit to one
+        else
+            state->ROM[byte_counter] = state->ROM[byte_counter] & ~bit_mask; // Set ROM bit to zero
+        onewire_bit_out (pin, ROM_bit);
+        if (bit_mask & 0x80) {
+            byte_counter++;
             bit_mask = 0x01;
-            while (ROM_bit_index<=64) {
-                Bit_A = onewire_bit_in(pin);
-                Bit_B = onewire_bit_in(pin);
-                if (Bit_A & Bit_B) {
-                    descrepancy_marker = 0; // data read error, this should never happen
-                    ROM_bit_index = 0xFF;
-                } else {
-                    if (Bit_A | Bit_B) {
-                        // Set ROM bit to Bit_A
-                        if (Bit_A) {
-                            DS1820_search_ROM[byte_counter] = DS1820_search_ROM[byte_counter] | bit_mask; // Set ROM bit to one
-                        } else {
-                            DS1820_search_ROM[byte_counter] = DS1820_search_ROM[byte_counter] & ~bit_mask; // Set ROM bit to zero
-                        }
-                    } else {
-                        // both bits A and B are low, so there are two or more devices present
-                        if ( ROM_bit_index == DS1820_last_descrepancy ) {
-                            DS1820_search_ROM[byte_counter] = DS1820_search_ROM[byte_counter] | bit_mask; // Set ROM bit to one
-                        } else {
-                            if ( ROM_bit_index > DS1820_last_descrepancy ) {
-                                DS1820_search_ROM[byte_counter] = DS1820_search_ROM[byte_counter] & ~bit_mask; // Set ROM bit to zero
-                                descrepancy_marker = ROM_bit_index;
-                            } else {
-                                if (( DS1820_search_ROM[byte_counter] & bit_mask) == 0x00 )
-                                    descrepancy_marker = ROM_bit_index;
-                            }
-                        }
-                    }
-                    onewire_bit_out (pin, DS1820_search_ROM[byte_counter] & bit_mask);
-                    ROM_bit_index++;
-                    if (bit_mask & 0x80) {
-                        byte_counter++;
-                        bit_mask = 0x01;
-                    } else {
-                        bit_mask = bit_mask << 1;
-                    }
-                }
+        } else {
+            bit_mask = bit_mask << 1;
+        }
+    }
+    state->last_discrepancy = descrepancy_marker;
+    return !ROM_checksum_error(state->ROM);
+}
+
+DS1820 *DS1820::find_probe(char *ROM_address) {
+    int byte_counter;
+    for (bus *b = buses; b != NULL; b = b->next) {
+        for (DS1820 *pointer = b->probes; pointer != NULL; pointer = pointer->_next) {
+            for(byte_counter=0;byte_counter<8;byte_counter++) {
+                if (pointer->_state.ROM[byte_counter] != ROM_address[byte_counter])
+                    break;
             }
-            DS1820_last_descrepancy = descrepancy_marker;
-            if (ROM_bit_index != 0xFF) {
-                int i = 1;
-                node *list_container;
-                while(1) {
-                    list_container = probes.pop(i);
-                    if (list_container == NULL) {                             //End of list, or empty list
-                        if (ROM_checksum_error(DS1820_search_ROM)) {          // Check the CRC
-                            return false;
-                        }
-                        for(byte_counter=0;byte_counter<8;byte_counter++)
-                            ROM_address[byte_counter] = DS1820_search_ROM[byte_counter];
-                        return true;
-                    } else {                    //Otherwise, check if ROM is already known
-                        bool equal = true;
-                        DS1820 *pointer = (DS1820*) list_container->data;
-                        char *ROM_compare = pointer->_ROM;
-                        
-                        for(byte_counter=0;byte_counter<8;byte_counter++) {
-                            if ( ROM_compare[byte_counter] != DS1820_search_ROM[byte_counter])
-                                equal = false;
-                        }
-                        if (equal)
-                            break;
-                        else
-                            i++;
-                    }
-                }                        
+            if (byte_counter == 8)
+                return pointer;
+        }
+    }
+    return NULL;
+}
+
+bool DS1820::verify_ROM() {
+// A search pass with all 64 bits forced only completes if this exact device answers,
+// a corrupted bit fails a pass as well so the probe gets a few tries
+    search_state state;
+    for (int attempt=0; attempt<ONEWIRE_RETRIES; attempt++) {
+        for(int byte_counter=0;byte_counter<8;byte_counter++)
+            state.ROM[byte_counter] = _state.ROM[byte_counter];
+        state.last_discrepancy = 0;
+        state.prefix_bits = 64;
+        if (search_ROM_pass(&_bus->datapin, 0xF0, &state))
+            return true;
+    }
+    return false;
+}
+
+bool DS1820::replace_ROM() {
+// Re-enumerate only the family branch this probe lived in, a swapped probe is adopted
+// by this object so its place in the probe list (and in the application) is kept.
+// The whole branch is walked: if the old ROM shows up it was only missed, nothing is adopted.
+    search_state state = {{FAMILY_CODE, 0, 0, 0, 0, 0, 0, 0}, 0, 8};
+    char candidate[8];
+    bool found = false;
+    int byte_counter;
+    do {
+        if (!search_ROM_pass(&_bus->datapin, 0xF0, &state))
+            return false;               // incomplete walk, the old ROM may have been missed
+        for(byte_counter=0;byte_counter<8;byte_counter++) {
+            if (state.ROM[byte_counter] != _state.ROM[byte_counter])
+                break;
+        }
+        if (byte_counter == 8)
+            return false;               // the old probe still answers
+        if (!found && (find_probe(state.ROM) == NULL)) {
+            for(byte_counter=0;byte_counter<8;byte_counter++)
+                candidate[byte_counter] = state.ROM[byte_counter];
+            found = true;
+        }
+    } while (state.last_discrepancy != 0);
+    if (!found)
+        return false;
+    for(byte_counter=0;byte_counter<8;byte_counter++)
+        _state.ROM[byte_counter] = candidate[byte_counter];
+    for(byte_counter=0;byte_counter<4;byte_counter++)
+        _state.reading[byte_counter] = 0x00;
+    _family = family_lookup(FAMILY_CODE);
+    _state.config_known = false;
+    _state.config_stored = false;
+    _state.reading_valid = false;
+    _state.conversion_pending = false;
+    _state.parasite_power = !read_power_supply();
+    return true;
+}
+
+int DS1820::maintainBus(PinName pin) {
+    int changed = 0;
+    bus *b = find_bus(pin);
+    if (b == NULL)
+        return 0;
+    for (DS1820 *probe = b->probes; probe != NULL; probe = probe->_next) {
+        probe->expire_reading();
+        if (probe->_state.answered || probe->verify_ROM()) {    // probes read since the last call need no bus traffic
+            if (probe->_state.misses != 0)
+                changed++;                      // back again
+            probe->_state.misses = 0;
+        } else {
+            if (probe->_state.misses == 0)
+                changed++;                      // just went missing
+            if (probe->_state.misses < DS1820_REPLACE_MISSES)
+                probe->_state.misses++;
+            if ((probe->_state.misses == DS1820_REPLACE_MISSES) && probe->replace_ROM()) {
+                probe->_state.misses = 0;
+                changed++;
             }
         }
-        if (DS1820_last_descrepancy == 0)
-            DS1820_done_flag = true;
+        probe->_state.answered = false;
     }
-    return return_value;
+    return changed;
+}
+
+bool DS1820::isPresent() {
+    return _state.misses == 0;
 }
  
 void DS1820::match_ROM() {
 // Used to select a specific device
     int i;
-    onewire_reset(&this->_datapin);
+    onewire_reset(&_bus->datapin);
     onewire_byte_out( 0x55);  //Match ROM command
     for (i=0;i<8;i++) {
-        onewire_byte_out(_ROM[i]);
+        onewire_byte_out(_state.ROM[i]);
     }
 }
  
 void DS1820::skip_ROM() {
-    onewire_reset(&this->_datapin);
+    onewire_reset(&_bus->datapin);
     onewire_byte_out(0xCC);   // Skip ROM command
 }
  
 bool DS1820::ROM_checksum_error(char *_ROM_address) {
-    char _CRC=0x00;
-    int i;
-    for(i=0;i<7;i++) // Only going to shift the lower 7 bytes
-        _CRC = CRC_byte(_CRC, _ROM_address[i]);
     // After 7 bytes CRC should equal the 8th byte (ROM CRC)
-    return (_CRC!=_ROM_address[7]); // will return true if there is a CRC checksum mis-match         
+    return (crc8(_ROM_address, 7)!=_ROM_address[7]); // will return true if there is a CRC checksum mis-match         
 }
  
-bool DS1820::RAM_checksum_error() {
-    char _CRC=0x00;
-    int i;
-    for(i=0;i<8;i++) // Only going to shift the lower 8 bytes
-        _CRC = CRC_byte(_CRC, RAM[i]);
+bool DS1820::RAM_checksum_error(const char *RAM) {
     // After 8 bytes CRC should equal the 9th byte (RAM CRC)
-    return (_CRC!=RAM[8]); // will return true if there is a CRC checksum mis-match        
+    return (crc8(RAM, 8)!=RAM[8]); // will return true if there is a CRC checksum mis-match        
+}
+
+char DS1820::crc8(const char *data, int length) {
+    char _CRC=0x00;
+    for(int i=0;i<length;i++)
+        _CRC = CRC_byte(_CRC, data[i]);
+    return _CRC;
 }
  
 char DS1820::CRC_byte (char _CRC, char byte ) {
@@ -303,117 +556,396 @@ return _CRC;
  
 int DS1820::convertTemperature(bool wait, devices device) {
     // Convert temperature into scratchpad RAM for all devices at once
-    int delay_time = 750; // Default delay time
-    char resolution;
-    if (device==all_devices)
-        skip_ROM();          // Skip ROM command, will convert for ALL devices
-    else {
-        match_ROM();
-        if ((FAMILY_CODE == FAMILY_CODE_DS18B20 ) || (FAMILY_CODE == FAMILY_CODE_DS1822 )) {
-            resolution = RAM[4] & 0x60;
-            if (resolution == 0x00) // 9 bits
-                delay_time = 94;
-            if (resolution == 0x20) // 10 bits
-                delay_time = 188;
-            if (resolution == 0x40) // 11 bits. Note 12bits uses the 750ms default
-                delay_time = 375;
+    int delay_time;
+    int attempt = 0;
+    uint32_t start;
+    do {
+        slot_overrun = false;
+        if (device==all_devices)
+            skip_ROM();      // Skip ROM command, will convert for ALL devices
+        else
+            match_ROM();
+        onewire_byte_out( 0x44);  // perform temperature conversion
+    } while (slot_overrun && ++attempt < ONEWIRE_RETRIES);    // a stretched slot may have turned into a reset
+    start = us_ticker_read();
+    if (device==all_devices) {
+        delay_time = 0;      // the slowest probe on this pin decides
+        for (DS1820 *probe = _bus->probes; probe != NULL; probe = probe->_next) {
+            int probe_time = probe->conversion_time();
+            if (probe_time > delay_time)
+                delay_time = probe_time;
+            probe->_state.conversion_start = start;
+            probe->_state.conversion_pending = true;
         }
+    } else {
+        delay_time = conversion_time();
+        _state.conversion_start = start;
+        _state.conversion_pending = true;
     }
     
-    onewire_byte_out( 0x44);  // perform temperature conversion
-    if (_parasite_power) {
-        if (_power_mosfet) {
-            _parasitepin = _power_polarity;     // Parasite power strong pullup
-            wait_ms(delay_time);
-            _parasitepin = !_power_polarity;
-            delay_time = 0;
-        } else {
-            _datapin.output();
-            _datapin.write(1);
-            wait_ms(delay_time);
-            _datapin.input();
-        }
-    } else {
-        if (wait) {
-            wait_ms(delay_time);
-            delay_time = 0;
-        }
+    if (_state.parasite_power || wait) {
+        hold_power(delay_time);
+        delay_time = 0;
     }
     return delay_time;
 }
+
+int DS1820::conversion_time() {
+    if ((_family != NULL) && _state.config_known)
+        return _family->conversion_time(_state.config[2]);
+    return 750;
+}
+
+void DS1820::hold_power(int delay_time) {
+// Waits for a conversion or EEPROM write to finish, parasite powered probes
+// get the strong pullup they need meanwhile. Pins keep their level during sleep.
+    if (!_state.parasite_power) {
+        idle(delay_time * 1000);
+    } else if (_bus->power_mosfet) {
+        _bus->parasitepin = _bus->power_polarity;     // Parasite power strong pullup
+        idle(delay_time * 1000);
+        _bus->parasitepin = !_bus->power_polarity;
+    } else {
+        _bus->datapin.output();
+        _bus->datapin.write(1);
+        idle(delay_time * 1000);
+        _bus->datapin.input();
+    }
+}
+
+static void power_update() {
+    uint32_t now = us_ticker_read();
+    power_stats.awake_us += now - power_last;
+    power_stats.busy_us += busy_pending_us;
+    busy_pending_us = 0;
+    power_last = now;
+}
+
+static void idle_wake() {
+    idle_woken = true;
+}
+
+void DS1820::idle(uint32_t us) {
+    if (!low_power || (us < LOW_POWER_MIN_US)) {
+        busy_pending_us += us;
+        wait_us(us);
+        return;
+    }
+    Timeout wake;
+    power_update();
+    idle_woken = false;
+    wake.attach_us(&idle_wake, us);
+    while (!idle_woken)
+        sleep();                    // any interrupt ends a sleep, only the timeout ends the wait
+    uint32_t now = us_ticker_read();
+    power_stats.sleep_us += now - power_last;
+    power_last = now;
+}
+
+void DS1820::setLowPower(bool enable) {
+    low_power = enable;
+}
+
+DS1820::memory_use DS1820::memoryUse() {
+    memory_use use = {sizeof(DS1820), sizeof(bus), 0, 0};
+    for (bus *b = buses; b != NULL; b = b->next) {
+        use.buses++;
+        for (DS1820 *probe = b->probes; probe != NULL; probe = probe->_next)
+            use.probes++;
+    }
+    return use;
+}
+
+DS1820::power_counters DS1820::powerCounters() {
+    power_update();
+    return power_stats;
+}
+
+void DS1820::resetPowerCounters() {
+    power_update();
+    power_stats.awake_us = 0;
+    power_stats.busy_us = 0;
+    power_stats.sleep_us = 0;
+}
  
-void DS1820::read_RAM() {
+void DS1820::read_RAM(char *RAM) {
     // This will copy the DS1820's 9 bytes of RAM data
-    // into the objects RAM array. Functions that use
-    // RAM values will automaticly call this procedure.
+    // into the RAM array.
     int i;
     match_ROM();             // Select this device
     onewire_byte_out( 0xBE);   //Read Scratchpad command
     for(i=0;i<9;i++) {
         RAM[i] = onewire_byte_in();
     }
-//    if (!RAM_checksum_error())
-//       crcerr = 1;
+}
+
+bool DS1820::read_scratchpad() {
+// read_RAM with CRC check, a valid read refreshes the reading and the configuration cache
+    char RAM[9];
+    bool crc_error;
+    int attempt = 0;
+    do {
+        slot_overrun = false;
+        read_RAM(RAM);
+        crc_error = RAM_checksum_error(RAM);
+        if (crc_error)
+            ONEWIRE_TRACE(trace_crc_error, 0);
+    } while ((slot_overrun || crc_error) && ++attempt < ONEWIRE_RETRIES);   // re-read, the conversion result is still there
+    if (crc_error) {
+        _state.reading_valid = false;     // the device could not be read, drop the cached reading
+        return false;
+    }
+    _state.answered = true;
+    _state.reading[0] = RAM[0];
+    _state.reading[1] = RAM[1];
+    _state.reading[2] = RAM[6];
+    _state.reading[3] = RAM[7];
+    for (int i=0; i<3; i++)
+        _state.config[i] = RAM[2+i];
+    _state.config_known = true;
+    return true;
 }
 
 bool DS1820::setResolution(unsigned int resolution) {
-    bool answer = false;
+    char config;
     resolution = resolution - 9;
-    if (resolution < 4) {
-        resolution = resolution<<5; // align the bits
-        RAM[4] = (RAM[4] & 0x60) | resolution; // mask out old data, insert new
-        write_scratchpad ((RAM[2]<<8) + RAM[3]);
-//        store_scratchpad (DS1820::this_device); // Need to test if this is required
-        answer = true;
+    if ((resolution >= 4) || (_family == NULL) || (_family->scratchpad_bytes != 3))   // needs a configuration register
+        return false;
+    if (!_state.config_known && !read_scratchpad())       // learn TH and TL so they are written back unchanged
+        return false;
+    config = (_state.config[2] & ~0x60) | (resolution<<5); // mask out old data, insert new
+    if (config != _state.config[2]) {                     // only touch the bus if the device differs
+        _state.config[2] = config;
+        _state.config_stored = false;
+        if (!write_scratchpad()) {
+            _state.config_known = false;    // the device may have taken part of it
+            return false;
+        }
     }
-    return answer;
+    return true;
 }
- 
-void DS1820::write_scratchpad(int data) {
-    RAM[3] = data;
-    RAM[2] = data>>8;
-    match_ROM();
-    onewire_byte_out(0x4E);   // Copy scratchpad into DS1820 ram memory
-    onewire_byte_out(RAM[2]); // T(H)
-    onewire_byte_out(RAM[3]); // T(L)
-    if ((FAMILY_CODE == FAMILY_CODE_DS18B20 ) || (FAMILY_CODE == FAMILY_CODE_DS1822 )) {
-        onewire_byte_out(RAM[4]); // Configuration register
+
+bool DS1820::recall_configuration(const char *wanted, bool *matches) {
+// Recall E2 into the scratchpad and compare it with wanted
+    int i;
+    recall_eeprom();
+    if (!read_scratchpad()) {
+        _state.config_known = false;    // the recall replaced it with something we could not read
+        return false;
     }
+    for (i=0; (i<_family->scratchpad_bytes) && (_state.config[i] == wanted[i]); i++)
+        ;
+    *matches = (i == _family->scratchpad_bytes);
+    return true;
+}
+
+bool DS1820::stage_configuration() {
+// Recall E2 first, if the EEPROM already holds the configuration config_stored is set and
+// there is nothing to write. Otherwise the scratchpad is left holding it, ready for a copy.
+    char wanted[3];
+    bool matches;
+    int i;
+    for (i=0; i<3; i++)
+        wanted[i] = _state.config[i];
+    if (!recall_configuration(wanted, &matches))
+        return false;
+    if (matches) {
+        _state.config_stored = true;
+        return true;
+    }
+    for (i=0; i<3; i++)
+        _state.config[i] = wanted[i];
+    if (!write_scratchpad()) {  // the recall replaced it
+        _state.config_known = false;
+        return false;           // never copy a damaged scratchpad to EEPROM
+    }
+    return true;
+}
+
+bool DS1820::verify_configuration() {
+// Recall E2 again after a copy, only reading it back proves the write
+    char wanted[3];
+    bool matches;
+    for (int i=0; i<3; i++)
+        wanted[i] = _state.config[i];
+    if (!recall_configuration(wanted, &matches))
+        return false;
+    _state.config_stored = matches;
+    return matches;
+}
+
+void DS1820::copy_scratchpad(devices device) {
+    if (device==all_devices)
+        skip_ROM();
+    else
+        match_ROM();
+    onewire_byte_out(0x48);     // Copy Scratchpad into EEPROM
+    hold_power(10);
+}
+
+bool DS1820::storeConfiguration() {
+    if (_state.config_stored)
+        return true;
+    if ((_family == NULL) || (_family->scratchpad_bytes == 0) || (!_state.config_known && !read_scratchpad()))
+        return false;
+    if (!stage_configuration())
+        return false;
+    if (_state.config_stored)
+        return true;
+    copy_scratchpad(this_device);
+    return verify_configuration();
+}
+
+int DS1820::configureAll(unsigned int resolution, bool store) {
+    int configured, staged;
+    bool failed;
+    DS1820 *holder;
+    configured = 0;
+    for (bus *b = buses; b != NULL; b = b->next) {
+        staged = 0;
+        failed = false;
+        holder = NULL;
+        for (DS1820 *probe = b->probes; probe != NULL; probe = probe->_next) {
+            if (!probe->setResolution(resolution)) {
+                if ((probe->_family != NULL) && (probe->_family->scratchpad_bytes == 3))
+                    failed = true;          // its write may have left a damaged scratchpad
+                continue;
+            }
+            if (store && !probe->_state.config_stored) {
+                if (!probe->stage_configuration()) {
+                    failed = true;
+                    continue;
+                }
+                if (!probe->_state.config_stored) {
+                    staged++;
+                    if ((holder == NULL) || probe->_state.parasite_power)
+                        holder = probe;     // a parasite powered probe needs the strong pullup during the copy
+                    continue;
+                }
+            }
+            configured++;
+        }
+        if (staged == 0)
+            continue;
+        // Several probes share one Copy Scratchpad and one 10 ms write. All devices on the
+        // bus copy then, the others rewrite what the recall just put in their scratchpad.
+        // A probe whose configuration or staging failed may hold a damaged scratchpad, so not then.
+        bool broadcast = (staged > 1) && !failed;
+        if (broadcast)
+            holder->copy_scratchpad(all_devices);
+        for (DS1820 *probe = b->probes; probe != NULL; probe = probe->_next) {
+            // Staged: a resolution capable probe whose scratchpad is known but not in EEPROM
+            if ((probe->_family == NULL) || (probe->_family->scratchpad_bytes != 3) ||
+                !probe->_state.config_known || probe->_state.config_stored)
+                continue;
+            if (!broadcast)
+                probe->copy_scratchpad(this_device);
+            if (probe->verify_configuration())
+                configured++;
+        }
+    }
+    return configured;
+}
+
+void DS1820::recall_eeprom() {
+    match_ROM();
+    onewire_byte_out(0xB8);     // Recall E2, copies TH, TL and config into the scratchpad
+    for (int i=0; (i<100) && !onewire_bit_in(&_bus->datapin); i++)
+        ;                       // the device sends 0s until the recall is done
+}
+ 
+bool DS1820::write_scratchpad() {
+    int attempt = 0;
+    if ((_family == NULL) || (_family->scratchpad_bytes == 0))
+        return true;
+    do {
+        slot_overrun = false;
+        match_ROM();
+        onewire_byte_out(0x4E);   // Copy scratchpad into DS1820 ram memory
+        for (int i=0; i<_family->scratchpad_bytes; i++)
+            onewire_byte_out(_state.config[i]); // T(H), T(L) and, if present, the configuration register
+    } while (slot_overrun && ++attempt < ONEWIRE_RETRIES);   // a written bit may have been lost
+    return !slot_overrun;
 }
  
 float DS1820::temperature(char scale) {
-// The data specs state that count_per_degree should be 0x10 (16), I found my devices
-// to have a count_per_degree of 0x4B (75). With the standard resolution of 1/2 deg C
-// this allowed an expanded resolution of 1/150th of a deg C. I wouldn't rely on this
-// being super acurate, but it does allow for a smooth display in the 1/10ths of a
-// deg C or F scales.
-    float answer, remaining_count, count_per_degree;
-    int reading;
-    read_RAM();
-    if (RAM_checksum_error())
-        // Indicate we got a CRC error
-        answer = invalid_conversion;
-    else {
-        reading = (RAM[1] << 8) + RAM[0];
-        if (reading & 0x8000) { // negative degrees C
-            reading = 0-((reading ^ 0xffff) + 1); // 2's comp then convert to signed int
-        }
-        answer = reading +0.0; // convert to floating point
-        if ((FAMILY_CODE == FAMILY_CODE_DS18B20 ) || (FAMILY_CODE == FAMILY_CODE_DS1822 )) {
-            answer = answer / 16.0f;
+    char RAM[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    float answer;
+    expire_reading();
+    // A finished conversion is always collected, the cached reading is older than its result
+    bool converted = _state.conversion_pending &&
+                     ((us_ticker_read() - _state.conversion_start) >= (uint32_t)conversion_time() * 1000);
+    if ((_state.max_age_ms == 0) || converted || (readingAge() > _state.max_age_ms)) {
+        if (_state.max_age_ms != 0) {
+            // Stale, refresh now. A conversion someone else started is waited for, not repeated
+            if (!_state.conversion_pending)
+                convertTemperature(true, this_device);
+            else {
+                int32_t remaining = conversion_time() * 1000 - (int32_t)(us_ticker_read() - _state.conversion_start);
+                if (remaining > 0)
+                    idle(remaining);
+            }
         }
-        else {
-            remaining_count = RAM[6];
-            count_per_degree = RAM[7];
-            answer = floor(answer/2.0f) - 0.25f + (count_per_degree - remaining_count) / count_per_degree;
+        if (read_scratchpad()) {
+            _state.reading_valid = true;
+            if (_state.conversion_pending)
+                _state.sample_time = _state.conversion_start;
+            _state.conversion_pending = false;
         }
-        if (scale=='F' or scale=='f')
+    }
+    if (!_state.reading_valid || (_family == NULL))
+        // Indicate we got a CRC error (or the device is not a thermometer)
+        answer = invalid_conversion;
+    else {
+        RAM[0] = _state.reading[0];
+        RAM[1] = _state.reading[1];
+        RAM[6] = _state.reading[2];
+        RAM[7] = _state.reading[3];
+        answer = _family->decode(RAM);
+        if ((answer != invalid_conversion) && (scale=='F' or scale=='f'))
             // Convert to deg F
             answer = answer * 9.0f / 5.0f + 32.0f;
     }
     return answer;
 }
  
+void DS1820::setMaxAge(uint32_t max_age_ms) {
+    _state.max_age_ms = max_age_ms;
+}
+
+void DS1820::expire_reading() {
+// The age is kept as a 32 bit microsecond difference, drop the reading before that can wrap
+    if (_state.reading_valid && ((us_ticker_read() - _state.sample_time) > DS1820_READING_HORIZON_US))
+        _state.reading_valid = false;
+}
+
+uint32_t DS1820::readingAge() {
+    expire_reading();
+    if (!_state.reading_valid)
+        return 0xFFFFFFFF;
+    return (us_ticker_read() - _state.sample_time) / 1000;
+}
+
+int DS1820::refresh() {
+    int delay_time;
+    if (_state.max_age_ms == 0)
+        return 1000;                    // caching is off, nothing to keep fresh
+    if (_state.parasite_power)
+        return 1000;                    // a conversion would block, leave it to temperature()
+    expire_reading();
+    if (_state.conversion_pending) {
+        delay_time = conversion_time() - (int)((us_ticker_read() - _state.conversion_start) / 1000);
+        if (delay_time > 0)
+            return delay_time;
+        temperature();                  // conversion done, collect it
+    }
+    // Start the next conversion early enough for it to land before the reading goes stale
+    delay_time = (int)_state.max_age_ms - conversion_time() - (_state.reading_valid ? (int)readingAge() : (int)_state.max_age_ms);
+    if (delay_time > 0)
+        return delay_time;
+    return convertTemperature(false, this_device);
+}
+
 bool DS1820::read_power_supply(devices device) {
 // This will return true if the device (or all devices) are Vcc powered
 // This will return false if the device (or ANY device) is parasite powered
@@ -422,7 +954,7 @@ bool DS1820::read_power_supply(devices device) {
     else
         match_ROM();
     onewire_byte_out(0xB4);   // Read power supply command
-    return onewire_bit_in(&this->_datapin);
+    return onewire_bit_in(&_bus->datapin);
 }
 
 
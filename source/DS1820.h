@@ -24,12 +24,20 @@
 #define MBED_DS1820_H
 
 #include "mbed.h"
-#include "LinkedList.h"
+#include "DS1820Family.h"
 
-#define FAMILY_CODE _ROM[0]
-#define FAMILY_CODE_DS1820 0x10
-#define FAMILY_CODE_DS18B20 0x28
-#define FAMILY_CODE_DS1822  0x22
+#define FAMILY_CODE _state.ROM[0]
+
+// Build-time RAM budget for the packed per-probe state, see DS1820::memoryUse
+#define DS1820_PROBE_STATE_BYTES    28
+
+// Cached readings older than this are dropped, before the 32 bit microsecond ticker wraps
+#define DS1820_READING_HORIZON_US   0x80000000u     // about 35 minutes
+
+// Consecutive maintainBus calls a probe must be missing before it adopts another ROM (1-3)
+#ifndef DS1820_REPLACE_MISSES
+#define DS1820_REPLACE_MISSES       3
+#endif
 
 /** DS1820 Dallas 1-Wire Temperature Probe
  *
@@ -59,6 +67,19 @@ public:
         invalid_conversion = -1000
     };
 
+    struct memory_use {
+        int probe_bytes;        /*!< RAM per DS1820 object */
+        int bus_bytes;          /*!< RAM per data pin, shared by its probes (heap allocated) */
+        int probes;             /*!< DS1820 objects that exist */
+        int buses;              /*!< data pins in use */
+    };
+
+    struct power_counters {
+        uint64_t awake_us;      /*!< time not spent in low power sleep */
+        uint64_t busy_us;       /*!< part of the awake time spent in busy-wait loops (slot timing, blocking waits) */
+        uint64_t sleep_us;      /*!< time spent in low power sleep */
+    };
+
     /** Create a probe object connected to the specified pins
     *
     * The probe might either by regular powered or parasite powered. If it is parasite
@@ -66,6 +87,9 @@ public:
     * data to Vdd. If it is parasite powered and the pin is not set, the regular data pin
     * is used to supply extra power when required. This will be sufficient as long as the 
     * number of probes is limitted.
+    *
+    * Probes on the same data pin share one bus object with the pins and the power
+    * settings, the power pin and polarity of the first probe created on it apply.
      *
      * @param data_pin DigitalInOut pin for the data bus
      * @param power_pin DigitalOut (optional) pin to control the power MOSFET
@@ -76,23 +100,64 @@ public:
 
     /** Function to see if there are DS1820 devices left on a pin which do not have a corresponding DS1820 object
     *
+    * Only the family branches of the enabled thermometer families are searched.
+    *
     * @return - true if there are one or more unassigned devices, otherwise false
       */
     static bool unassignedProbe(PinName pin);
 
+    /** Lists the 1-Wire devices on a pin that are not thermometers of an enabled
+    * family (switches, EEPROMs, ...). These are skipped when probes are enumerated.
+    * This walks the whole search tree, so it is slower than enumerating the probes.
+    *
+    * @param pin - data pin of the bus
+    * @param ROM_addresses - receives up to max ROM codes
+    * @param max - capacity of ROM_addresses
+    * @return - number of such devices found, can be more than max
+      */
+    static int foreignDevices(PinName pin, char (*ROM_addresses)[8], int max);
+
+    /** Background maintenance for hot-plugged probes, call this periodically
+    *
+    * Probes that returned a valid reading since the last call are taken as present,
+    * the others are checked with targeted search passes (retried, so a noisy bus
+    * does not make a probe disappear). A probe missing for DS1820_REPLACE_MISSES
+    * calls in a row searches its own family branch for a device without a DS1820
+    * object and takes over its ROM, unless its old ROM still answers in that search.
+    * Other probes on the bus are not disturbed.
+    *
+    * @param pin - data pin of the bus to maintain
+    * @return - number of probes whose presence or ROM changed
+      */
+    static int maintainBus(PinName pin);
+
+    /** Function to see if this probe answered at the last maintainBus call
+    *
+    * @return - true if the probe is on the bus
+      */
+    bool isPresent();
+
     /** This routine will initiate the temperature conversion within
       * one or all DS1820 probes. 
       *
       * @param wait if true or parisitic power is used, waits up to 750 ms for 
       * conversion otherwise returns immediatly.
       * @param device allows the function to apply to a specific device or
-      * to all devices on the 1-Wire bus.
+      * to all devices on the 1-Wire bus. For all devices the wait is set by the
+      * slowest known probe on the pin, 750 ms while any resolution is unknown.
       * @returns milliseconds untill conversion will complete.
       */
     int convertTemperature(bool wait, devices device=all_devices);
 
     /** This function will return the probe temperature. Approximately 10ms per
       * probe to read its RAM, do CRC check and convert temperature on the LPC1768.
+      * The read is repeated (up to 3 attempts) after a CRC error or when an interrupt
+      * stretched one of the slots past its timing window.
+      *
+      * With a max age set (see setMaxAge) a reading younger than that is returned
+      * from memory without bus traffic, an older one is refreshed first: a pending
+      * conversion is waited for, otherwise a conversion of this probe is started.
+      * A conversion that has finished meanwhile is always read, whatever the age.
       *
       * @param scale, may be either 'c' or 'f'
       * @returns temperature for that scale, or DS1820::invalid_conversion (-1000) if CRC error detected.
@@ -100,41 +165,169 @@ public:
     float temperature(char scale='c');
 
     /** This function sets the temperature resolution for the DS18B20
-      * in the configuration register.
+      * in the configuration register. The probe keeps a cache of its TH, TL and
+      * configuration register, nothing is sent if the device already has this resolution.
       *
       * @param a number between 9 and 12 to specify resolution
-      * @returns true if successful
+      * @returns true if successful, false for families without a configuration register
       */ 
     bool setResolution(unsigned int resolution);       
 
+    /** Sets how old a reading returned by temperature() may be
+      *
+      * @param max_age_ms age in ms, 0 (the default) reads the scratchpad on every call
+      */
+    void setMaxAge(uint32_t max_age_ms);
+
+    /** Age of the reading temperature() returns from memory, counted from the start of
+      * its conversion. Readings older than about 35 minutes are dropped; that is only
+      * noticed if the probe is used (or maintainBus runs) at least that often.
+      *
+      * @returns age in ms, 0xFFFFFFFF if there is no valid reading
+      */
+    uint32_t readingAge();
+
+    /** Keeps the cached reading fresh from a background task, without blocking: starts
+      * a conversion when the reading is about to exceed the max age and collects it
+      * once done. Does nothing while the max age is 0, and for a parasite powered
+      * probe: its conversion holds the strong pullup, and so the caller, until it is
+      * done. temperature() refreshes such a probe when its reading is stale.
+      *
+      * @returns ms until refresh wants to be called again
+      */
+    int refresh();
+
+    /** Makes the current configuration survive a power cycle (Copy Scratchpad to EEPROM).
+      * The EEPROM is recalled first and only written if it differs, afterwards it is
+      * recalled again to verify the write.
+      *
+      * @returns true if the EEPROM holds the current configuration
+      */
+    bool storeConfiguration();
+
+    /** Sets the resolution of all probes in one pass, probes that are already
+      * configured cost no bus traffic. With store, probes on a bus whose EEPROM
+      * differs share a single Copy Scratchpad (Skip ROM) and its 10 ms write.
+      *
+      * @param resolution a number between 9 and 12
+      * @param store also commit the configuration to EEPROM, see storeConfiguration
+      * @returns number of probes that were configured successfully
+      */
+    static int configureAll(unsigned int resolution, bool store=false);
+
+    /** Dallas/Maxim 1-Wire CRC8 as used for the ROM and scratchpad
+      *
+      * @param data bytes to check
+      * @param length number of bytes
+      * @returns the CRC, which equals the byte following the data if it is intact
+      */
+    static char crc8(const char *data, int length);
+
+    /** Lets the library sleep (mbed sleep(), woken by a Timeout) instead of busy-waiting
+      * while a conversion or EEPROM write runs, and in idle. Waits shorter than 2 ms
+      * always busy-wait. Interrupts and other Timeouts keep working during sleep.
+      *
+      * @param enable true for the low power mode, off by default
+      */
+    static void setLowPower(bool enable);
+
+    /** Waits, sleeping in low power mode
+      *
+      * @param us time to wait in microseconds
+      */
+    static void idle(uint32_t us);
+
+    /** Time awake, busy and asleep since resetPowerCounters, for estimating battery life.
+      * The counters use the 32 bit us_ticker, call this (or let the library wait)
+      * at least every 70 minutes.
+      */
+    static power_counters powerCounters();
+
+    static void resetPowerCounters();
+
+    /** RAM used by the probes and their buses, for budgeting large probe counts
+      */
+    static memory_use memoryUse();
+
 private:
-    bool _parasite_power;
-    bool _power_mosfet;
-    bool _power_polarity;
-    
+    friend struct DS1820SizeReport;     // bench/sizes.cpp
+
+    struct search_state {       // keeps a ROM search resumable between passes
+        char ROM[8];
+        int last_discrepancy;
+        int prefix_bits;        // number of leading ROM bits that are fixed
+    };
+
+    struct probe_state {        // everything a probe knows about its device, packed
+        char ROM[8];
+        char config[3];                 // TH, TL, configuration register
+        uint8_t parasite_power : 1;
+        uint8_t misses : 2;             // maintainBus calls in a row the probe was not found
+        uint8_t answered : 1;           // gave a valid reading since the last maintainBus
+        uint8_t config_known : 1;       // config holds what the device has in its scratchpad
+        uint8_t config_stored : 1;      // ... and in its EEPROM
+        uint8_t reading_valid : 1;      // reading passed the CRC check
+        uint8_t conversion_pending : 1; // a conversion was started and not read yet
+        char reading[4];                // scratchpad bytes 0, 1, 6 and 7, all the decoders need
+        uint32_t max_age_ms;
+        uint32_t sample_time;           // us_ticker time the conversion in reading was started
+        uint32_t conversion_start;
+    };
+    static_assert(sizeof(probe_state) <= DS1820_PROBE_STATE_BYTES, "DS1820 probe state exceeds its RAM budget");
+    static_assert((DS1820_REPLACE_MISSES >= 1) && (DS1820_REPLACE_MISSES <= 3),
+                  "DS1820_REPLACE_MISSES must fit the 2 bit misses counter");
+
+    struct bus {                // one per data pin
+        bus(PinName data_pin, PinName power_pin, bool power_polarity);
+
+        PinName pin;
+        DigitalInOut datapin;
+        DigitalOut parasitepin;
+        bool power_mosfet;
+        bool power_polarity;
+        DS1820 *probes;                 // in creation order, linked through _next
+        bus *next;
+    };
+
+    static const family_ops *family_lookup(char family_code);
     static char CRC_byte(char _CRC, char byte );
     static bool onewire_reset(DigitalInOut *pin);
     void match_ROM();
     void skip_ROM();
     static bool search_ROM_routine(DigitalInOut *pin, char command, char *ROM_address);
+    static bool search_unassigned(DigitalInOut *pin, char command, search_state *state, char *ROM_address);
+    static bool search_ROM_pass(DigitalInOut *pin, char command, search_state *state);
+    static bool search_ROM_walk(DigitalInOut *pin, char command, search_state *state);
+    static DS1820 *find_probe(char *ROM_address);
+    static bus *find_bus(PinName pin);
+    bool verify_ROM();
+    void expire_reading();
+    bool replace_ROM();
     static void onewire_bit_out (DigitalInOut *pin, bool bit_data);
     void onewire_byte_out(char data);
     static bool onewire_bit_in(DigitalInOut *pin);
     char onewire_byte_in();
     static bool ROM_checksum_error(char *_ROM_address);
-    bool RAM_checksum_error();
-    void read_RAM();
+    static bool RAM_checksum_error(const char *RAM);
+    void read_RAM(char *RAM);
+    bool read_scratchpad();
+    int conversion_time();
+    void hold_power(int delay_time);
+    void recall_eeprom();
+    bool recall_configuration(const char *wanted, bool *matches);
+    bool stage_configuration();
+    bool verify_configuration();
+    void copy_scratchpad(devices device);
     static bool unassignedProbe(DigitalInOut *pin, char *ROM_address);
-    void write_scratchpad(int data);
+    bool write_scratchpad();
     bool read_power_supply(devices device=this_device);
 
-    DigitalInOut _datapin;
-    DigitalOut _parasitepin;
-    
-    char _ROM[8];
-    char RAM[9];
-    
-    static LinkedList<node> probes;
+    bus *_bus;
+    DS1820 *_next;              // next probe on the same bus
+    const family_ops *_family;  // NULL if the family is not a (supported) thermometer
+    probe_state _state;
+
+    static bus *buses;
 };
 
 
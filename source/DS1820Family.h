@@ -0,0 +1,113 @@
+/* Compile-time description of the 1-Wire thermometer families handled by DS1820
+ *
+ * Every family gets a family_traits specialisation with its conversion time table,
+ * scratchpad layout and raw-to-temperature decode. A probe looks up its family_ops
+ * once when its ROM is enumerated, after that no call branches on the family code.
+ *
+ * Families can be left out of a build to save flash, e.g. for a DS18B20 only
+ * deployment compile with -DDS1820_FAMILY_DS1820=0 -DDS1820_FAMILY_DS1822=0.
+ * Adding a family is a new family_traits specialisation plus an entry in the
+ * table in DS1820.cpp.
+ */
+
+#ifndef MBED_DS1820_FAMILY_H
+#define MBED_DS1820_FAMILY_H
+
+#include <stdint.h>
+#include <math.h>
+
+#define FAMILY_CODE_DS1820      0x10
+#define FAMILY_CODE_DS18B20     0x28
+#define FAMILY_CODE_DS1822      0x22
+#define FAMILY_CODE_MAX31850    0x3B
+
+#ifndef DS1820_FAMILY_DS1820
+#define DS1820_FAMILY_DS1820    1
+#endif
+#ifndef DS1820_FAMILY_DS18B20
+#define DS1820_FAMILY_DS18B20   1
+#endif
+#ifndef DS1820_FAMILY_DS1822
+#define DS1820_FAMILY_DS1822    1
+#endif
+#ifndef DS1820_FAMILY_MAX31850
+#define DS1820_FAMILY_MAX31850  0
+#endif
+
+/** Per-family behaviour, resolved once per probe
+ */
+struct family_ops {
+    char code;                                  /*!< ROM family code */
+    char scratchpad_bytes;                      /*!< bytes sent by Write Scratchpad (TH, TL, config) */
+    int (*conversion_time)(char config);        /*!< ms for a conversion with the given config register */
+    float (*decode)(const char *RAM);           /*!< scratchpad to degrees C, or -1000 on a device fault */
+};
+
+template<char family> struct family_traits;
+
+inline int16_t family_raw(const char *RAM) {
+    return (int16_t)(((uint8_t)RAM[1] << 8) | (uint8_t)RAM[0]);
+}
+
+struct ds18b20_traits {
+    enum { scratchpad_bytes = 3 };
+
+    static int conversion_time(char config) {
+        switch (config & 0x60) {
+            case 0x00: return 94;   // 9 bits
+            case 0x20: return 188;  // 10 bits
+            case 0x40: return 375;  // 11 bits
+            default:   return 750;  // 12 bits
+        }
+    }
+
+    static float decode(const char *RAM) {
+        return family_raw(RAM) / 16.0f;
+    }
+};
+
+template<> struct family_traits<FAMILY_CODE_DS18B20> : ds18b20_traits {};
+template<> struct family_traits<FAMILY_CODE_DS1822> : ds18b20_traits {};
+
+template<> struct family_traits<FAMILY_CODE_DS1820> {
+    enum { scratchpad_bytes = 2 };          // no configuration register
+
+    static int conversion_time(char) {
+        return 750;
+    }
+
+    static float decode(const char *RAM) {
+// The data specs state that count_per_degree should be 0x10 (16), I found my devices
+// to have a count_per_degree of 0x4B (75). With the standard resolution of 1/2 deg C
+// this allowed an expanded resolution of 1/150th of a deg C.
+        float remaining_count = (uint8_t)RAM[6];
+        float count_per_degree = (uint8_t)RAM[7];
+        return floor(family_raw(RAM) / 2.0f) - 0.25f + (count_per_degree - remaining_count) / count_per_degree;
+    }
+};
+
+template<> struct family_traits<FAMILY_CODE_MAX31850> {
+    enum { scratchpad_bytes = 0 };          // scratchpad is read only
+
+    static int conversion_time(char) {
+        return 100;
+    }
+
+    static float decode(const char *RAM) {
+        if (RAM[0] & 0x01)                  // thermocouple fault
+            return -1000;
+        return (family_raw(RAM) >> 2) * 0.25f;
+    }
+};
+
+template<char family> const family_ops *family_ops_for() {
+    static const family_ops ops = {
+        family,
+        family_traits<family>::scratchpad_bytes,
+        &family_traits<family>::conversion_time,
+        &family_traits<family>::decode
+    };
+    return &ops;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "DS1820Pipeline.h"
+#include "us_ticker_api.h"
+
+// Slots per probe: Match ROM (8 + 64) and Convert T (8) to start a conversion,
+// Match ROM and Read Scratchpad (8 + 72) to read it
+#define PIPELINE_START_SLOTS    80
+#define PIPELINE_READ_SLOTS     152
+
+DS1820Pipeline::DS1820Pipeline(DS1820 **probes, int count, int groups, reading_handler handler) {
+    int i;
+    if (groups < 1)
+        groups = 1;
+    if (groups > count)
+        groups = count;
+    _probes = probes;
+    _group_count = groups;
+    _handler = handler;
+    _groups = new group[groups];
+    for (i=0; i<groups; i++) {
+        _groups[i].first = i * count / groups;
+        _groups[i].count = (i + 1) * count / groups - _groups[i].first;
+        _groups[i].start = 0;
+        _groups[i].due = 0;
+        _groups[i].duration_us = 0;
+        _groups[i].converting = false;
+    }
+    for (i=0; i<count; i++)
+        _probes[i]->setMaxAge(0);
+    _cycle_us = 0;
+    _lead_us = 0;
+    _started = false;
+}
+
+DS1820Pipeline::~DS1820Pipeline() {
+    delete [] _groups;
+}
+
+int DS1820Pipeline::poll() {
+    int32_t next = 0x7FFFFFFF;
+    int32_t remaining;
+    uint32_t now, start_us, bus_us, spacing;
+    int i;
+    if (_group_count == 0)
+        return 1000;                            // no probes, nothing to schedule
+    if (!_started) {
+        // Group 0 sets the pace. Its start is timed, reading takes the slot ratio longer;
+        // the cycle has to fit a conversion plus that bus time, and all groups in turn.
+        now = us_ticker_read();
+        start_group(&_groups[0]);
+        start_us = us_ticker_read() - now;
+        bus_us = start_us * (PIPELINE_START_SLOTS + PIPELINE_READ_SLOTS) / PIPELINE_START_SLOTS;
+        _cycle_us = _groups[0].duration_us + bus_us;
+        if (_cycle_us < bus_us * _group_count)
+            _cycle_us = bus_us * _group_count;
+        spacing = (_cycle_us + _group_count - 1) / _group_count;
+        _cycle_us = spacing * _group_count;
+        // A group is started right after the read that comes a conversion time (rounded up
+        // to whole spacings) before its own, so starts and reads never compete for the bus
+        _lead_us = (_groups[0].duration_us + start_us + spacing - 1) / spacing * spacing;
+        for (i=0; i<_group_count; i++)
+            _groups[i].due = now + _lead_us + i * spacing;
+        _started = true;
+    }
+    for (i=0; i<_group_count; i++) {
+        group *g = &_groups[i];
+        if (g->converting && ((int32_t)(next_event(g) - us_ticker_read()) <= 0)) {
+            read_group(g);
+            g->due += _cycle_us;                // stay on the grid so groups do not drift together
+            now = us_ticker_read();
+            if ((int32_t)(g->due - now) < (int32_t)g->duration_us)
+                g->due = now + _lead_us;        // fell behind, the next conversion cannot finish in time
+        }
+    }
+    for (i=0; i<_group_count; i++) {            // after the reads, which were due first
+        group *g = &_groups[i];
+        if (!g->converting && ((int32_t)(next_event(g) - us_ticker_read()) <= 0))
+            start_group(g);
+    }
+    now = us_ticker_read();
+    for (i=0; i<_group_count; i++) {
+        remaining = next_event(&_groups[i]) - now;
+        if (remaining < next)
+            next = remaining;
+    }
+    if (next < 0)
+        next = 0;
+    return (next + 999) / 1000;
+}
+
+uint32_t DS1820Pipeline::next_event(const group *g) {
+// Time of the group's next bus work: its read, or the start of its next conversion
+    if (!g->converting)
+        return g->due - _lead_us;
+    if ((int32_t)(g->start + g->duration_us - g->due) > 0)
+        return g->start + g->duration_us;       // started late, let it finish
+    return g->due;
+}
+
+void DS1820Pipeline::start_group(group *g) {
+    int i, delay_time;
+    g->start = us_ticker_read();
+    g->duration_us = 0;
+    for (i=g->first; i<g->first + g->count; i++) {
+        delay_time = _probes[i]->convertTemperature(false, DS1820::this_device);
+        if ((uint32_t)delay_time * 1000 > g->duration_us)
+            g->duration_us = delay_time * 1000;
+    }
+    g->converting = true;
+}
+
+void DS1820Pipeline::read_group(group *g) {
+    for (int i=g->first; i<g->first + g->count; i++)
+        _handler(_probes[i], _probes[i]->temperature(), g->start);
+    g->converting = false;
+}
@@ -0,0 +1,89 @@
+#ifndef MBED_DS1820_PIPELINE_H
+#define MBED_DS1820_PIPELINE_H
+
+#include "mbed.h"
+#include "DS1820.h"
+
+/** Staggered convert/read pipeline for a steady stream of readings
+ *
+ * The probes are split into groups that are read at evenly spaced moments of a
+ * fixed cycle. A group's conversion is started about one conversion time before
+ * its read is due, right after the read of an earlier group, and while it
+ * converts the other groups are read and started. The bus keeps working and
+ * readings arrive a group at a time instead of in one burst per broadcast
+ * conversion. A reading is at most one conversion time, one group spacing
+ * (cycle / groups) and the bus time of its group (starting and reading it) old.
+ *
+ * The cycle is the longer of one conversion plus the bus time of a group and the
+ * bus time of all groups. In the second case the bus is saturated, groups are
+ * read back to back and restarted soon after their read, so the age of a
+ * reading can grow to the whole cycle.
+ *
+ * Conversions are addressed per probe, so this only pays off with externally
+ * powered probes; a parasite powered probe blocks the bus for its whole conversion.
+ * The pipeline owns the reading schedule and sets the max age of its probes to 0.
+ *
+ * Example:
+ * @code
+ * void store(DS1820 *probe, float temperature, uint32_t timestamp_us) {
+ *     ring_buffer_put(probe, temperature, timestamp_us);
+ * }
+ *
+ * DS1820Pipeline pipeline(probes, 32, 4, store);
+ *
+ * int main() {
+ *     while(1)
+ *         wait_ms(pipeline.poll());
+ * }
+ * @endcode
+ */
+class DS1820Pipeline {
+public:
+    /** Called for every reading, in the order the probes are read
+     *
+     * @param probe the probe that was read
+     * @param temperature deg C, or DS1820::invalid_conversion
+     * @param timestamp_us us_ticker time at which the conversion of its group was started
+     */
+    typedef void (*reading_handler)(DS1820 *probe, float temperature, uint32_t timestamp_us);
+
+    /** Create a pipeline
+     *
+     * @param probes probes to read
+     * @param count number of probes, with 0 poll does nothing
+     * @param groups number of groups converting in turn, 1 to count
+     * @param handler receives the readings
+     */
+    DS1820Pipeline(DS1820 **probes, int count, int groups, reading_handler handler);
+    ~DS1820Pipeline();
+
+    /** Does the bus work that is due now: reads the groups whose read is due and
+     *  starts the conversions of the groups that are read a conversion time later.
+     *
+     * @returns ms until poll should be called again
+     */
+    int poll();
+
+private:
+    struct group {
+        int first, count;       // range in _probes
+        uint32_t start;         // us_ticker time the conversion was started
+        uint32_t due;           // next read on the group's time grid
+        uint32_t duration_us;   // slowest conversion in the group
+        bool converting;
+    };
+
+    uint32_t next_event(const group *g);
+    void start_group(group *g);
+    void read_group(group *g);
+
+    DS1820 **_probes;
+    group *_groups;
+    int _group_count;
+    reading_handler _handler;
+    uint32_t _cycle_us;         // time between two conversions of the same group
+    uint32_t _lead_us;          // a group's conversion is started this long before its read
+    bool _started;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "DS1820Sampler.h"
+#include "us_ticker_api.h"
+
+#define SAMPLER_SLACK_US    1000    // this late still counts as on time
+
+DS1820Sampler::DS1820Sampler(DS1820 **probes, int count, uint32_t period_ms) {
+    _probes = probes;
+    _count = count;
+    _period_us = period_ms * 1000;
+    _deadline = 0;
+    _sequence = 0;
+    _missed = 0;
+    _started = false;
+}
+
+bool DS1820Sampler::sample(reading *readings) {
+    uint32_t now = us_ticker_read();
+    uint32_t skipped = 0;
+    int i, delay_time;
+
+    if (!_started) {
+        _deadline = now;
+        _started = true;
+    } else if ((int32_t)(now - _deadline) > SAMPLER_SLACK_US) {
+        // Too late for this deadline, move to the next one on the same grid
+        skipped = (now - _deadline) / _period_us + 1;
+        _deadline += skipped * _period_us;
+        _sequence += skipped;
+        _missed += skipped;
+    }
+    wait_until(_deadline);
+
+    uint32_t timestamp = us_ticker_read();
+    if (_count > 0) {
+        // Without probes there is no bus to convert on, only the deadlines are kept
+        delay_time = _probes[0]->convertTemperature(false, DS1820::all_devices);
+        if (delay_time > 0)
+            wait_until(timestamp + delay_time * 1000);
+    }
+    for (i=0; i<_count; i++) {
+        readings[i].temperature = _probes[i]->temperature();
+        readings[i].timestamp_us = timestamp;
+        readings[i].sequence = _sequence;
+    }
+
+    _deadline += _period_us;
+    _sequence++;
+    return skipped == 0;
+}
+
+uint32_t DS1820Sampler::missedDeadlines() {
+    return _missed;
+}
+
+void DS1820Sampler::wait_until(uint32_t deadline) {
+    int32_t remaining = deadline - us_ticker_read();
+    if (remaining > 0)
+        DS1820::idle(remaining);
+}
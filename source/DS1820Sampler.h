@@ -0,0 +1,72 @@
+#ifndef MBED_DS1820_SAMPLER_H
+#define MBED_DS1820_SAMPLER_H
+
+#include "mbed.h"
+#include "DS1820.h"
+
+/** Periodic sampling of a set of probes on a fixed time grid
+ *
+ * Conversions are started at absolute deadlines (start + n * period) instead of
+ * sleeping between readings, so bus, conversion and processing time do not add
+ * up to drift. A deadline that has already passed is skipped, not taken late,
+ * and shows up as a gap in the sequence numbers.
+ *
+ * All waiting goes through DS1820::idle, so with DS1820::setLowPower(true) a
+ * sample is a short burst of bus activity between two sleeps: one until the
+ * conversion is done, one until the next deadline.
+ *
+ * Example:
+ * @code
+ * DS1820 probe(DATA_PIN);
+ * DS1820 *probes[] = {&probe};
+ * DS1820Sampler sampler(probes, 1, 250);     // 4 Hz
+ *
+ * int main() {
+ *     DS1820Sampler::reading r;
+ *     while(1) {
+ *         sampler.sample(&r);
+ *         printf("%lu %lu %3.1f\r\n", r.sequence, r.timestamp_us, r.temperature);
+ *     }
+ * }
+ * @endcode
+ */
+class DS1820Sampler {
+public:
+    struct reading {
+        float temperature;      /*!< deg C, or DS1820::invalid_conversion */
+        uint32_t timestamp_us;  /*!< us_ticker time at which the conversion was started */
+        uint32_t sequence;      /*!< deadline number, consecutive unless deadlines were missed */
+    };
+
+    /** Create a sampler
+     *
+     * @param probes probes to read, they must share one data pin (the conversion is broadcast)
+     * @param count number of probes, with 0 sample() only waits for the deadlines
+     * @param period_ms sampling period in milliseconds
+     */
+    DS1820Sampler(DS1820 **probes, int count, uint32_t period_ms);
+
+    /** Waits for the next deadline, converts and reads all probes
+     *
+     * @param readings array with one entry per probe
+     * @returns false if deadlines were missed before this sample
+     */
+    bool sample(reading *readings);
+
+    /** Number of deadlines skipped because the previous sample (or the caller) overran them
+     */
+    uint32_t missedDeadlines();
+
+private:
+    void wait_until(uint32_t deadline);
+
+    DS1820 **_probes;
+    int _count;
+    uint32_t _period_us;
+    uint32_t _deadline;
+    uint32_t _sequence;
+    uint32_t _missed;
+    bool _started;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "DS1820Trace.h"
+
+#if DS1820_TRACE
+
+#include "us_ticker_api.h"
+
+trace_record DS1820Trace::_ring[DS1820_TRACE_RECORDS];
+int DS1820Trace::_next = 0;
+int DS1820Trace::_count = 0;
+uint32_t DS1820Trace::_last_us = 0;
+
+void DS1820Trace::record(uint8_t kind, uint8_t value) {
+    uint32_t now = us_ticker_read();
+    uint32_t delta = now - _last_us;
+    trace_record *r = &_ring[_next];
+    r->delta_us = delta < 0xFFFF ? delta : 0xFFFF;
+    r->kind = kind;
+    r->value = value;
+    _last_us = now;
+    if (++_next == DS1820_TRACE_RECORDS)
+        _next = 0;
+    if (_count < DS1820_TRACE_RECORDS)
+        _count++;
+}
+
+void DS1820Trace::dump(writer write) {
+    char bytes[8] = {'1', 'W', 'T', 'R', DS1820_TRACE_VERSION, sizeof(trace_record),
+                     (char)(_count & 0xFF), (char)(_count >> 8)};
+    int index = _next - _count;
+    if (index < 0)
+        index += DS1820_TRACE_RECORDS;
+    write(bytes, 8);
+    for (int i=0; i<_count; i++) {
+        trace_record *r = &_ring[index];
+        bytes[0] = r->delta_us & 0xFF;
+        bytes[1] = r->delta_us >> 8;
+        bytes[2] = r->kind;
+        bytes[3] = r->value;
+        write(bytes, 4);
+        if (++index == DS1820_TRACE_RECORDS)
+            index = 0;
+    }
+}
+
+void DS1820Trace::clear() {
+    _next = 0;
+    _count = 0;
+}
+
+int DS1820Trace::count() {
+    return _count;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/* Slot-level trace of the 1-Wire bus, for finding intermittent errors
+ *
+ * Build with -DDS1820_TRACE=1 to record every reset, write slot and read slot
+ * with its time and value in a RAM ring of DS1820_TRACE_RECORDS records of 4
+ * bytes (256 by default, 1 KB). Without it ONEWIRE_TRACE expands to nothing and
+ * the 1-Wire code is the same as in a build without this file.
+ *
+ * A record is taken after the timing-critical part of its slot. A slot that
+ * overran its timing window is preceded by a trace_overrun record, a scratchpad
+ * that failed its CRC is followed by a trace_crc_error record.
+ *
+ * Dump format, little endian: "1WTR", version (1), record size (4), record
+ * count (uint16), then the records oldest first as delta_us (uint16), kind,
+ * value. bench/trace_replay decodes a dump and replays it on the simulated bus.
+ *
+ * Example:
+ * @code
+ * Serial pc(USBTX, USBRX);
+ *
+ * void to_serial(const char *data, int length) {
+ *     while (length--)
+ *         pc.putc(*data++);
+ * }
+ *
+ * if (probe.temperature() == DS1820::invalid_conversion)
+ *     DS1820Trace::dump(to_serial);
+ * @endcode
+ */
+
+#ifndef MBED_DS1820_TRACE_H
+#define MBED_DS1820_TRACE_H
+
+#include <stdint.h>
+
+#ifndef DS1820_TRACE
+#define DS1820_TRACE            0
+#endif
+#ifndef DS1820_TRACE_RECORDS
+#define DS1820_TRACE_RECORDS    256
+#endif
+
+#define DS1820_TRACE_VERSION    1
+
+enum trace_kind {
+    trace_reset,            // value: 1 if a presence pulse was seen
+    trace_write,            // value: bit written
+    trace_read,             // value: bit read
+    trace_overrun,          // the next slot was stretched past its timing window
+    trace_crc_error         // the scratchpad just read failed its CRC
+};
+
+struct trace_record {
+    uint16_t delta_us;      // since the previous record, 0xFFFF if longer
+    uint8_t kind;
+    uint8_t value;
+};
+
+#if DS1820_TRACE
+
+class DS1820Trace {
+public:
+    typedef void (*writer)(const char *data, int length);
+
+    static void record(uint8_t kind, uint8_t value);
+
+    /** Writes the ring in the dump format, oldest record first
+     *
+     * @param write called with consecutive pieces of the dump
+     */
+    static void dump(writer write);
+
+    static void clear();
+
+    /** @returns number of records in the ring */
+    static int count();
+
+private:
+    static trace_record _ring[DS1820_TRACE_RECORDS];
+    static int _next;
+    static int _count;
+    static uint32_t _last_us;
+};
+
+#define ONEWIRE_TRACE(kind, value)  DS1820Trace::record(kind, value)
+
+#else
+
+#define ONEWIRE_TRACE(kind, value)  do {} while (0)
+
+#endif
+
+#endif
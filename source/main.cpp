@@ -1,17 +1,22 @@
 #include "MicroBit.h"
 #include "DS1820.h"
+#include "DS1820Sampler.h"
 
 MicroBit uBit;
  
 #define DATA_PIN        3
+#define PERIOD_MS       1000
 DS1820 probe((PinName)DATA_PIN);
+DS1820 *probes[] = {&probe};
+DS1820Sampler sampler(probes, 1, PERIOD_MS);
  
 int main() {
   uBit.init();
+    DS1820Sampler::reading reading;
     while(1) {
-        probe.convertTemperature(true, DS1820::all_devices);         //Start temperature conversion, wait until ready
-        //uBit.serial.printf("It is %3.1foC\r\n", probe.temperature());
-        uBit.serial.printf("It is %doC\r\n", (int)probe.temperature());
-        wait(1);
+        sampler.sample(&reading);          //Waits for the next deadline, then converts and reads
+        //uBit.serial.printf("It is %3.1foC\r\n", reading.temperature);
+        uBit.serial.printf("%d %d It is %doC (missed %d)\r\n", (int)reading.sequence, (int)reading.timestamp_us,
+                           (int)reading.temperature, (int)sampler.missedDeadlines());
     }
 }